@@ -9,13 +9,89 @@
 #include <vector>
 #include <algorithm>
 #include <filesystem>
+#include <map>
+#include <unordered_map>
+#include <cctype>
+#include <array>
+#include <functional>
+#include <set>
+#include <cstdint>
+#include <optional>
+#include <list>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <string_view>
+#include <cmath>
+#include <numeric>
+#include <deque>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <sys/file.h>
+    #include <cerrno>
+#endif
+
+#if defined(__linux__)
+    #include <sys/sendfile.h>
+    #include <sys/resource.h>
+    #include <sys/syscall.h>
+#endif
 
 using namespace std;
 namespace fs = filesystem;
 
 const fs::path saveDir = "savedNotes"; // Directory that notes are saved to.
 const string noteExt = ".cppn"; // Extension that notes are saved with.
+const string logExt = ".cppnlog"; // Extension of log note directories.
+const string outlineExt = ".cppno"; // Extension of saved note outlines.
+const string packedExt = ".cppnz"; // Extension of notes packed into frames.
+const size_t packedFrameSize = 256 << 10; // Bytes of text per packed frame.
+const uint64_t maxBlockSize = 64 << 20; // Largest block decompressBlock accepts.
+const uint64_t logSegmentSize = 1 << 20; // Bytes per segment of a log note.
 const string headSep = " | "; // Seperator used in the head of a note.
+const size_t minCompletionLength = 4; // Shortest word offered as a completion.
+const size_t maxCompletions = 5; // Completions shown per '!complete' request.
+const size_t maxTypoDistance = 2; // Edits allowed in a suggested title.
+const size_t maxSuggestions = 3; // Titles suggested for a misspelled title.
+const size_t maxMergedResults = 1000; // Results shown across mounted stores.
+const size_t maxRelated = 10; // Notes shown by 'related'.
+const size_t relatedQueryTerms = 32; // Rarest words of a note used to find candidates.
+const size_t timelineBlockSize = 64 << 10; // Bytes of a plain note read at a time by 'timeline'.
+const size_t timelineBufferBudget = 16 << 20; // Bytes 'timeline' keeps buffered across all notes.
+const fs::path replaceStaging = saveDir / "replace.staged"; // Notes rewritten by 'replace'.
+const fs::path replaceJournal = saveDir / "replace.journal"; // Notes 'replace' is committing.
+const size_t sortFanIn = 64; // Sorted runs merged at once by 'sort'.
+const fs::path expiryJournal = saveDir / "expiry.journal"; // Expiry times set with 'ttl'.
+const uint64_t maxTtl = 100ULL * 365 * 86400; // Longest TTL accepted, in seconds.
+const size_t sortBufferSize = 256 << 10; // Buffer of each run file being read or written.
+const string attachmentExt = ".cppna"; // Extension of a note's attachment directory.
+const uint64_t attachmentChunkSize = 4 << 20; // Bytes per chunk file of an attachment.
+const uint64_t maxPaxHeaderSize = 64 << 10; // Largest pax extended header 'import-tar' reads.
+const size_t defaultMemoryBudget = 256; // Memory budget in MB, see 'stats'.
+const size_t streamChunkSize = 1 << 20; // Bytes read at a time from big notes.
+const size_t tailWindowSize = 16 << 10; // Bytes of a large note shown on open.
+const int defaultMetricsInterval = 15; // Seconds between metrics file writes.
+const fs::path logPath = saveDir / "cppnotes.log"; // Diagnostics log file.
+const uintmax_t logFileSize = 4 << 20; // Bytes at which the log is rotated.
+const int logFilesKept = 3; // Rotated logs kept besides the current one.
+const int maintenanceIdleSeconds = 2; // Prompt idle time before maintenance.
+const int sharedCatalogWaitSeconds = 2; // Longest wait for a shared catalog being written.
+const size_t defaultMaintenanceRate = 4 << 20; // Maintenance bytes per second.
+
+// Notes bigger than this many bytes are streamed instead of loaded whole.
+// Can be changed with CPPNOTES_LARGE_NOTE_MB.
+size_t largeNoteThreshold = 16 << 20;
+
+// Bytes of lines 'sort' and 'uniq' hold at once; bigger notes are sorted in
+// runs on disk. Can be changed with CPPNOTES_SORT_MEMORY_MB.
+size_t sortMemoryLimit = 64 << 20;
 
 // Command used to clear screen is platform-dependent.
 #if defined(_WIN32) || defined(_WIN64)
@@ -146,205 +222,8456 @@ bool validateInput(const string& input) {
     return true;
 }
 
-/// Saves a given note to the current directory.
+/// Returns the user-written part of a note's content, i.e. everything after
+/// the head line and the blank line that follows it.
 ///
 /// Args:
-/// - 'note': The note that is being saved.
-void saveNote(const Note& note) {
-    const auto filePath = saveDir / (note.getName() + noteExt);
-    ofstream outfile(filePath);
+/// - 'content': The full content of a note, head included.
+string noteBody(const string& content) {
+    const size_t startUserContent = content.find("\n\n");
 
-    if (outfile.is_open()) {
-        outfile << note.getContent();
-        outfile.close();
-        cout << note.getName() << " successfully saved!\n\n";
-    } else {
-        cout << "ERROR: " << note.getName() << " failed to save.\n\n";
+    if (startUserContent == string::npos) {
+        return "";
     }
+
+    return content.substr(startUserContent + 2);
 }
 
-/// Handles the editing of a note.
+/// Streams the user-written part of the note at <filePath> to <consume> in
+/// pieces of at most 'streamChunkSize' bytes, cut at line ends where
+/// possible, so notes of any size can be read in bounded memory.
 ///
 /// Args:
-/// - 'note': The note that is being opened.
-void openNote(Note& note) {
-    string line;
-    string newContent;
-    const size_t startUserContent = note.getContent().find("\n\n");
-    const string userContent = note.getContent().substr(startUserContent + 2);
-    const string head = note.getName() + headSep + note.getTimestamp() + "\n\n";
+/// - 'filePath': The path of the note being read.
+/// - 'consume': Called with each piece of the note's body, in order.
+void streamNoteBody(const fs::path& filePath,
+                    const function<void(const string&)>& consume) {
+    ifstream infile(filePath, ios::binary);
+    string skipped;
+    getline(infile, skipped); // The head line.
+    getline(infile, skipped); // The blank line after the head.
 
-    system(clearScreen);
-    cout << "" << note.getName() << headSep << note.getTimestamp() << "\n";
-    cout << "Type !quit on a new line to exit.\n\n";
-    cout << userContent;
+    string buffer(streamChunkSize, '\0');
+    string carry;
 
-    while (true) {
-        getline(cin, line);
-        if (line == "!quit") break;
-        newContent += line + "\n";
-    }
+    while (infile.read(&buffer[0], buffer.size()) || infile.gcount() > 0) {
+        carry.append(buffer, 0, infile.gcount());
+        const size_t lastLineEnd = carry.rfind('\n');
 
-    note.setContent(head + userContent + newContent);
+        if (lastLineEnd != string::npos && carry.size() < streamChunkSize * 2) {
+            consume(carry.substr(0, lastLineEnd + 1));
+            carry.erase(0, lastLineEnd + 1);
+        } else {
+            consume(carry);
+            carry.clear();
+        }
+    }
 
-    saveNote(note);
+    if (!carry.empty()) consume(carry);
 }
 
-/// Creates a new note and opens it.
+/// Runs <task> for every index below <count> on a pool of worker threads,
+/// one per hardware thread, and waits for all of them to finish.
 ///
 /// Args:
-/// - 'title': The given name of the new note.
-void createNote(const string& title) {
-    if (fs::exists(saveDir / (title + noteExt))) {
-        cout << "ERROR: '" << title << "' already exists.\n\n";
-    } else {
-        Note note(title, getCurrentTime(), "");
-        note.setContent(note.getName() + headSep + note.getTimestamp() + "\n\n");
-        openNote(note);
+/// - 'count': The number of tasks.
+/// - 'task': Called once with each index; must be safe to run in parallel.
+void runParallel(size_t count, const function<void(size_t)>& task) {
+    const size_t workers = min<size_t>(max(1u, thread::hardware_concurrency()),
+                                       count);
+    atomic<size_t> next{0};
+    vector<thread> pool;
+
+    for (size_t i = 0; i < workers; ++i) {
+        pool.emplace_back([&] {
+            for (size_t index; (index = next++) < count;) task(index);
+        });
     }
+
+    for (auto& worker : pool) worker.join();
 }
 
-/// Loads a note from the current directory.
+/// The severity of a log event.
+enum class LogLevel { Debug, Info, Warn, Error };
+
+/// A structured diagnostics log, kept apart from what the user sees.
 ///
-/// Args:
-/// - 'title': The name of the requested note.
-/// - 'appendMode': True if user is appending, false if user is overwriting.
-void loadNote(const string& title, const bool& appendMode) {
-    const auto filePath = saveDir / (title + noteExt);
-    ifstream infile(filePath);
-    string head;
-    string line;
-    string loadedContent;
+/// Each event has a level, a name and key/value fields, and is written to
+/// 'logPath' as one logfmt line. Logging only formats the event into a
+/// slot of a fixed ring buffer; slots are claimed with a compare-and-swap,
+/// so any thread can log without a lock. A background thread drains the
+/// ring to the file and rotates it once it reaches 'logFileSize'. If the
+/// ring is full the event is dropped and counted rather than blocking.
+///
+/// Attributes:
+/// - 'slots': The ring; a slot is ready to read once its 'sequence' is one
+///   past its position, and free to write once it equals its position.
+/// - 'head': The next position to write, shared by every thread.
+/// - 'tail': The next position to read, owned by the drain thread.
+/// - 'threshold': Events below this level are skipped.
+class Logger {
+    private:
+        static constexpr size_t slotCount = 1024;
+        static constexpr size_t textSize = 240;
 
-    if (infile.is_open()) {
-        system(clearScreen);
-        getline(infile, head);
+        struct Slot {
+            atomic<size_t> sequence;
+            LogLevel level;
+            int64_t millis;
+            size_t length;
+            char text[textSize];
+        };
 
-        size_t sep = head.find(headSep);
-        Note note(title, head.substr(sep + headSep.length()), "");
-        
-        if (appendMode) {
-            for (int i = 1; getline(infile, line); ++i) {
-                loadedContent += line + "\n";
+        array<Slot, slotCount> slots;
+        atomic<size_t> head{0};
+        size_t tail = 0;
+        atomic<uint64_t> dropped{0};
+        atomic<int> threshold{static_cast<int>(LogLevel::Info)};
+        atomic<bool> stopping{false};
+        thread drainer;
+        ofstream file;
+        uintmax_t fileSize = 0;
+
+        /// Appends <value> to the slot's text, cut short if it is full.
+        static void put(Slot& slot, string_view value) {
+            const size_t count = min(value.size(), textSize - slot.length);
+            memcpy(slot.text + slot.length, value.data(), count);
+            slot.length += count;
+        }
+
+        void rotate() {
+            file.close();
+            error_code error;
+
+            for (int i = logFilesKept; i > 0; --i) {
+                const fs::path from = i == 1 ? logPath
+                    : fs::path(logPath.string() + "." + to_string(i - 1));
+                fs::rename(from, logPath.string() + "." + to_string(i), error);
             }
-        } else {
-            loadedContent = "\n";
+
+            file.open(logPath, ios::app);
+            fileSize = 0;
         }
 
-        note.setContent(head + "\n" + loadedContent);
-        openNote(note);
+        void writeLine(LogLevel level, int64_t millis, string_view text) {
+            const array<const char*, 4> levels = {"debug", "info", "warn", "error"};
+            const time_t seconds = millis / 1000;
+            tm utc{};
+#if defined(_WIN32) || defined(_WIN64)
+            gmtime_s(&utc, &seconds);
+#else
+            gmtime_r(&seconds, &utc);
+#endif
+            char stamp[32];
+            const size_t length = strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &utc);
+            snprintf(stamp + length, sizeof(stamp) - length, ".%03dZ",
+                     static_cast<int>(millis % 1000));
 
-    } else {
-        cout << "ERROR: '" << title << "' does not exist or "
-                "failed to load.\n\n";
-    }
-}
+            string line = string("ts=") + stamp + " level=" +
+                          levels[static_cast<int>(level)] + " msg=";
+            line.append(text);
+            line += "\n";
 
-/// Prints a list of all saved notes to the user.
-void listNotes() {
-    const auto dirIter = fs::directory_iterator(saveDir);
+            file << line;
+            fileSize += line.size();
+            if (fileSize >= logFileSize) rotate();
+        }
 
-    if (!fs::exists(saveDir) || !fs::is_directory(saveDir)) {
-        cout << "ERROR: Could not find save directory.\n\n";
-        return;
-    }
+        /// Writes every ready event to the file. Returns how many there were.
+        size_t drain() {
+            size_t count = 0;
 
-    if (dirIter == fs::directory_iterator{}) {
-        cout << "No files found.\n\n";
-        return;
-    }
+            while (true) {
+                Slot& slot = slots[tail % slotCount];
+                if (slot.sequence.load(memory_order_acquire) != tail + 1) break;
 
-    for (const auto& entry : dirIter) {
-        auto path = entry.path();
-        cout << "> " << path.stem().string() << "\n";
-    }
+                writeLine(slot.level, slot.millis, string_view(slot.text, slot.length));
+                slot.sequence.store(tail + slotCount, memory_order_release);
+                tail++;
+                count++;
+            }
 
-    cout << "\n";
-}
+            if (const uint64_t lost = dropped.exchange(0)) {
+                writeLine(LogLevel::Warn, chrono::duration_cast<chrono::milliseconds>(
+                              chrono::system_clock::now().time_since_epoch()).count(),
+                          "log_dropped count=" + to_string(lost));
+            }
 
-/// Deletes the note with the given name.
+            if (count > 0) file.flush();
+            return count;
+        }
+
+    public:
+        Logger() {
+            for (size_t i = 0; i < slotCount; ++i) {
+                slots[i].sequence.store(i, memory_order_relaxed);
+            }
+        }
+
+        void setThreshold(LogLevel level) {
+            threshold.store(static_cast<int>(level), memory_order_relaxed);
+        }
+
+        /// Logs event <event> at <level> with key/value <fields>.
+        void log(LogLevel level, string_view event,
+                 initializer_list<pair<const char*, string_view>> fields = {}) {
+            if (static_cast<int>(level) < threshold.load(memory_order_relaxed)) return;
+
+            size_t position = head.load(memory_order_relaxed);
+            Slot* slot;
+
+            while (true) {
+                slot = &slots[position % slotCount];
+                const size_t sequence = slot->sequence.load(memory_order_acquire);
+
+                if (sequence == position) {
+                    if (head.compare_exchange_weak(position, position + 1,
+                                                   memory_order_relaxed)) break;
+                } else if (sequence < position) {
+                    dropped.fetch_add(1, memory_order_relaxed);
+                    return;
+                } else {
+                    position = head.load(memory_order_relaxed);
+                }
+            }
+
+            slot->level = level;
+            slot->millis = chrono::duration_cast<chrono::milliseconds>(
+                chrono::system_clock::now().time_since_epoch()).count();
+            slot->length = 0;
+            put(*slot, event);
+
+            for (const auto& [key, value] : fields) {
+                put(*slot, " ");
+                put(*slot, key);
+                put(*slot, "=\"");
+
+                // Quotes and line breaks would split the line, so drop them.
+                for (char c : value) {
+                    if (slot->length == textSize) break;
+                    slot->text[slot->length++] = c == '"' || c == '\n' ? '\'' : c;
+                }
+
+                put(*slot, "\"");
+            }
+
+            slot->sequence.store(position + 1, memory_order_release);
+        }
+
+        /// Opens the log file and starts draining the ring to it.
+        void start() {
+            error_code error;
+            fileSize = fs::file_size(logPath, error);
+            if (error) fileSize = 0;
+            file.open(logPath, ios::app);
+
+            drainer = thread([this] {
+                while (!stopping.load()) {
+                    if (drain() == 0) this_thread::sleep_for(chrono::milliseconds(10));
+                }
+                drain();
+            });
+        }
+
+        /// Writes out what is left in the ring and stops the drain thread.
+        void stop() {
+            stopping.store(true);
+            if (drainer.joinable()) drainer.join();
+        }
+};
+
+Logger logger; // Diagnostics written to 'logPath'; see Logger.
+
+/// The parts of the program whose memory use is tracked by the governor.
+enum class Subsystem {
+    SearchIndex, Catalog, QueryCache, EditorBuffers, Mounts, Count
+};
+
+const size_t subsystemCount = static_cast<size_t>(Subsystem::Count);
+
+/// Keeps track of how many bytes each subsystem is holding and keeps the
+/// total under a single budget by asking subsystems to let go of memory.
 ///
-/// Args:
-/// - 'title': The name of the note that the user wants to delete.
-void deleteNote(const string& title) {
-    const auto filePath = saveDir / (title + noteExt);
+/// Subsystems holding state that can be rebuilt from the saved notes are
+/// asked first, largest first. Subsystems without an evictor (such as the
+/// text being typed into the editor) are counted but never evicted.
+///
+/// While a command or maintenance step holds the governor, eviction waits
+/// until it lets go, so nothing is freed between being built and being
+/// used. Memory use can go over budget during the command, never after it.
+///
+/// Attributes:
+/// - 'names': The name of each subsystem, as shown by 'stats'.
+/// - 'usage': The bytes each subsystem currently holds.
+/// - 'evictors': Frees a subsystem's memory and returns what is still held.
+/// - 'rebuildable': True if a subsystem's memory can be rebuilt from disk.
+/// - 'budget': The total number of bytes all subsystems may hold.
+/// - 'holds': How many callers are holding off eviction.
+class MemoryGovernor {
+    private:
+        const array<string, subsystemCount> names = {
+            "search index", "catalog", "query cache", "editor buffers",
+            "mounted stores"
+        };
+        array<size_t, subsystemCount> usage{};
+        array<function<size_t()>, subsystemCount> evictors;
+        array<bool, subsystemCount> rebuildable{};
+        size_t budget = defaultMemoryBudget << 20;
+        int holds = 0;
 
-    if (fs::remove(filePath)) {
-        cout << title << " successfully deleted!\n\n";
-    } else {
-        cout << "ERROR: " << title << " not found or failed to delete.\n\n";
-    }
-}
+        static size_t index(Subsystem system) {
+            return static_cast<size_t>(system);
+        }
 
-/// Handler function for the user commands and prompts.
-void promptHandler() {
-    string cmd;
+        /// Evicts the largest subsystem that matches <wantRebuildable>.
+        ///
+        /// Returns false if there was nothing left to evict.
+        bool evictLargest(bool wantRebuildable) {
+            size_t victim = subsystemCount;
 
-    // User loop.
-    while (true) {
-        cout << "$~ ";
-        getline(cin, cmd);
-        const string arg = extractArg(cmd);
+            for (size_t i = 0; i < subsystemCount; ++i) {
+                if (evictors[i] && rebuildable[i] == wantRebuildable &&
+                    usage[i] > 0 &&
+                    (victim == subsystemCount || usage[i] > usage[victim])) {
+                    victim = i;
+                }
+            }
 
-        if (cmd == "exit") {
-            break;
+            if (victim == subsystemCount) return false;
 
-        } else if (cmd == "help") {
-            cout << "- 'new [note]' to create a new note.\n"
-                    "- 'app [note]' to append an existing note.\n"
-                    "- 'ow [note]' to overwrite an existing note.\n"
-                    "- 'del [note]' to delete an existing note.\n"
-                    "- 'ls' to list all saved files.\n"
-                    "- 'cls' to clear the screen.\n"
-                    "- 'exit' to exit the program.\n\n";
-        
-        } else if (cmd == "cls") {
-            system(clearScreen);
+            const size_t before = usage[victim];
+            usage[victim] = evictors[victim]();
+            logger.log(LogLevel::Info, "memory_evicted", {
+                {"subsystem", names[victim]},
+                {"freed", to_string(before - min(before, usage[victim]))}});
+            return usage[victim] < before;
+        }
 
-        } else if (cmd == "ls") {
-            listNotes();
-        
-        // Any conditions after these require valid input for filenames.
-        } else if (countWords(cmd) == 2 && !validateInput(arg)) {
-            cout << "'" << arg << "' is not a valid filename.\n\n";
-        
-        } else if (cmd.compare(0, 4, "del ") == 0 && countWords(cmd) == 2) {
-            deleteNote(arg);
+    public:
+        size_t getBudget() const { return budget; }
+        size_t used(Subsystem system) const { return usage[index(system)]; }
+        void setBudget(size_t bytes) { budget = bytes; enforce(); }
 
-        } else if (cmd.compare(0, 4, "new ") == 0 && countWords(cmd) == 2) {
-            createNote(arg);
+        size_t total() const {
+            size_t sum = 0;
+            for (size_t bytes : usage) sum += bytes;
+            return sum;
+        }
 
-        } else if (cmd.compare(0, 4, "app ") == 0 && countWords(cmd) == 2) {
-            loadNote(arg, true);
-        
-        } else if (cmd.compare(0, 3, "ow ") == 0 && countWords(cmd) == 2) {
-            loadNote(arg, false);
+        /// Registers the function used to free <system>'s memory.
+        void registerEvictor(Subsystem system, bool canRebuild,
+                             function<size_t()> evictor) {
+            evictors[index(system)] = move(evictor);
+            rebuildable[index(system)] = canRebuild;
+        }
 
-        } else if (cmd.compare(0, 3, "del") == 0 ||
-                   cmd.compare(0, 3, "new") == 0 ||
-                   cmd.compare(0, 3, "app") == 0 ||
-                   cmd.compare(0, 2, "ow") == 0) {
-            cout << "ERROR: Missing argument (filename).\n\n";
-            
-        } else {
-            cout << "'" << cmd << "' is not a valid command.\n\n";
+        /// Records that <system> now holds <bytes>, evicting if that puts the
+        /// total over budget and nothing holds off eviction.
+        void set(Subsystem system, size_t bytes) {
+            const bool grew = bytes > usage[index(system)];
+            usage[index(system)] = bytes;
+            if (grew && holds == 0) enforce();
         }
-    }
+
+        /// Holds off eviction until the matching release(), for the length
+        /// of a command that builds state and then uses it.
+        void hold() { holds++; }
+
+        /// Ends a hold(), evicting whatever is over budget once the last
+        /// hold ends.
+        void release() {
+            if (holds > 0) holds--;
+            if (holds == 0) enforce();
+        }
+
+        /// Evicts subsystems until the total fits in the budget, preferring
+        /// state that can be rebuilt.
+        void enforce() {
+            while (total() > budget && evictLargest(true)) {}
+            while (total() > budget && evictLargest(false)) {}
+        }
+
+        /// Prints the memory held by each subsystem.
+        void report(ostream& out) const {
+            out << fixed << setprecision(2);
+
+            for (size_t i = 0; i < subsystemCount; ++i) {
+                out << "  " << left << setw(16) << names[i] << right
+                    << setw(10) << usage[i] / 1024.0 << " KB\n";
+            }
+
+            out << "  " << left << setw(16) << "total" << right << setw(10)
+                << total() / 1024.0 << " KB of " << (budget >> 20)
+                << " MB budget\n";
+            out.unsetf(ios::floatfield);
+        }
+};
+
+MemoryGovernor governor; // Accounts for the memory held by each subsystem.
+
+/// The commands counted by the metrics exporter. Anything else counts as
+/// "other".
+const array<string, 31> metricCommands = {
+    "new", "app", "ow", "del", "ls", "query", "export-html", "export-tar",
+    "import-tar", "stats", "newlog", "tail", "compress", "outline", "open",
+    "view", "mount", "mounts", "unmount", "related", "timeline", "replace",
+    "sort", "uniq", "ttl", "attach", "attachments", "extract", "cls", "help",
+    "other"
+};
+
+/// A latency histogram that can be observed from any thread without locks.
+///
+/// Attributes:
+/// - 'counts': Observations per bucket; the last bucket is over every bound.
+/// - 'sumNanos': The sum of all observations, in nanoseconds.
+class LatencyHistogram {
+    public:
+        static constexpr array<double, 9> bounds = {
+            0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5
+        };
+
+        void observe(double seconds) {
+            size_t bucket = 0;
+            while (bucket < bounds.size() && seconds > bounds[bucket]) bucket++;
+            counts[bucket].fetch_add(1, memory_order_relaxed);
+            sumNanos.fetch_add(static_cast<uint64_t>(seconds * 1e9),
+                               memory_order_relaxed);
+        }
+
+        /// Writes the histogram as OpenMetrics samples of family <name>.
+        void write(ostream& out, const string& name, const string& labels) const {
+            const string prefix = labels.empty() ? "{" : "{" + labels + ",";
+            uint64_t total = 0;
+
+            for (size_t i = 0; i <= bounds.size(); ++i) {
+                total += counts[i].load(memory_order_relaxed);
+                out << name << "_bucket" << prefix << "le=\"";
+                if (i < bounds.size()) out << bounds[i]; else out << "+Inf";
+                out << "\"} " << total << "\n";
+            }
+
+            const string suffix = labels.empty() ? "" : "{" + labels + "}";
+            out << name << "_sum" << suffix << " "
+                << sumNanos.load(memory_order_relaxed) / 1e9 << "\n";
+            out << name << "_count" << suffix << " " << total << "\n";
+        }
+
+    private:
+        array<atomic<uint64_t>, bounds.size() + 1> counts{};
+        atomic<uint64_t> sumNanos{0};
+};
+
+/// Counters and gauges for long-running sessions, written out in the
+/// OpenMetrics text format.
+///
+/// Everything is an atomic updated with relaxed ordering, so recording
+/// never takes a lock. Gauges owned by the main thread, such as memory use,
+/// are copied in by publishGauges() after each command, so the writer
+/// thread never reads another thread's state.
+///
+/// Attributes:
+/// - 'commands', 'latencies': Count and duration of each command.
+/// - 'fsyncLatency': Duration of each fsync made when saving.
+/// - 'bytesRead', 'bytesWritten': Note bytes read and written.
+/// - 'memory': Bytes held by each governed subsystem.
+/// - 'cacheHits', 'cacheMisses': Lookups in the query result cache.
+/// - 'catalogNotes': Notes in the catalog.
+class Metrics {
+    public:
+        array<atomic<uint64_t>, metricCommands.size()> commands{};
+        array<LatencyHistogram, metricCommands.size()> latencies;
+        LatencyHistogram fsyncLatency;
+        atomic<uint64_t> bytesRead{0};
+        atomic<uint64_t> bytesWritten{0};
+        array<atomic<uint64_t>, subsystemCount> memory{};
+        atomic<uint64_t> cacheHits{0};
+        atomic<uint64_t> cacheMisses{0};
+        atomic<uint64_t> catalogNotes{0};
+
+        /// Records one run of the command typed as <cmd>.
+        void recordCommand(const string& cmd, double seconds) {
+            const string name = cmd.substr(0, cmd.find(' '));
+            size_t i = 0;
+            while (i + 1 < metricCommands.size() && metricCommands[i] != name) i++;
+
+            commands[i].fetch_add(1, memory_order_relaxed);
+            latencies[i].observe(seconds);
+        }
+
+        /// Writes every metric in the OpenMetrics text format.
+        void write(ostream& out) const {
+            const array<string, subsystemCount> subsystems = {
+                "search_index", "catalog", "query_cache", "editor_buffers",
+                "mounted_stores"
+            };
+
+            out << "# TYPE cppnotes_commands counter\n"
+                   "# HELP cppnotes_commands Commands run at the prompt.\n";
+            for (size_t i = 0; i < metricCommands.size(); ++i) {
+                out << "cppnotes_commands_total{command=\"" << metricCommands[i]
+                    << "\"} " << commands[i].load(memory_order_relaxed) << "\n";
+            }
+
+            out << "# TYPE cppnotes_command_latency_seconds histogram\n"
+                   "# HELP cppnotes_command_latency_seconds Time taken by "
+                   "each command, editing sessions included.\n";
+            for (size_t i = 0; i < metricCommands.size(); ++i) {
+                latencies[i].write(out, "cppnotes_command_latency_seconds",
+                                   "command=\"" + metricCommands[i] + "\"");
+            }
+
+            out << "# TYPE cppnotes_fsync_latency_seconds histogram\n"
+                   "# HELP cppnotes_fsync_latency_seconds Time taken by "
+                   "fsync when saving notes.\n";
+            fsyncLatency.write(out, "cppnotes_fsync_latency_seconds", "");
+
+            out << "# TYPE cppnotes_read_bytes counter\n"
+                   "# HELP cppnotes_read_bytes Note bytes read.\n"
+                   "cppnotes_read_bytes_total "
+                << bytesRead.load(memory_order_relaxed) << "\n"
+                << "# TYPE cppnotes_written_bytes counter\n"
+                   "# HELP cppnotes_written_bytes Note bytes written.\n"
+                   "cppnotes_written_bytes_total "
+                << bytesWritten.load(memory_order_relaxed) << "\n";
+
+            out << "# TYPE cppnotes_memory_bytes gauge\n"
+                   "# HELP cppnotes_memory_bytes Memory held by each "
+                   "subsystem.\n";
+            for (size_t i = 0; i < subsystemCount; ++i) {
+                out << "cppnotes_memory_bytes{subsystem=\"" << subsystems[i]
+                    << "\"} " << memory[i].load(memory_order_relaxed) << "\n";
+            }
+
+            const uint64_t hits = cacheHits.load(memory_order_relaxed);
+            const uint64_t misses = cacheMisses.load(memory_order_relaxed);
+            out << "# TYPE cppnotes_query_cache_hits counter\n"
+                   "cppnotes_query_cache_hits_total " << hits << "\n"
+                << "# TYPE cppnotes_query_cache_misses counter\n"
+                   "cppnotes_query_cache_misses_total " << misses << "\n"
+                << "# TYPE cppnotes_query_cache_hit_ratio gauge\n"
+                   "cppnotes_query_cache_hit_ratio "
+                << (hits + misses == 0 ? 0.0 : double(hits) / (hits + misses))
+                << "\n"
+                << "# TYPE cppnotes_catalog_notes gauge\n"
+                   "cppnotes_catalog_notes "
+                << catalogNotes.load(memory_order_relaxed) << "\n"
+                << "# EOF\n";
+        }
+
+        /// Replaces the file at <path> with the current metrics, atomically
+        /// so a scraper never sees half a file.
+        bool writeFile(const fs::path& path) const {
+            const fs::path tempPath = path.string() + ".tmp";
+            ofstream outfile(tempPath);
+            write(outfile);
+            outfile.close();
+
+            error_code error;
+            if (outfile) fs::rename(tempPath, path, error);
+            return outfile && !error;
+        }
+};
+
+Metrics metrics; // Counters exported when CPPNOTES_METRICS_FILE is set.
+
+/// Returns the seconds passed since <start>.
+double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
 }
 
-/// CPPNotes is a barebones console notes program that allows the user to
-/// create and load notes through their terminal.
-int main() {
-    cout << "Welcome to CPPNotes!\n";
-    cout << "Enter a command (help | new | app | ow | del | ls | cls | "
-            "exit)\n\n";
+/// Flushes the file at <filePath> to disk, timing the fsync for the metrics.
+///
+/// Args:
+/// - 'filePath': The file just written.
+void syncFile(const fs::path& filePath) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    const int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0) return;
+
+    const auto start = chrono::steady_clock::now();
+    fsync(fd);
+    metrics.fsyncLatency.observe(secondsSince(start));
+    close(fd);
+#else
+    (void)filePath;
+#endif
+}
+
+/// Flushes every file written to the store to disk in one go, for batches
+/// of files that are committed together. On Linux this is a single syncfs
+/// on the save directory's filesystem; elsewhere each file is synced.
+///
+/// Args:
+/// - 'written': The files that were written.
+void syncStore(const vector<fs::path>& written) {
+#if defined(__linux__)
+    (void)written;
+    const int fd = open(saveDir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return;
+
+    const auto start = chrono::steady_clock::now();
+    syncfs(fd);
+    metrics.fsyncLatency.observe(secondsSince(start));
+    close(fd);
+#else
+    for (const auto& filePath : written) syncFile(filePath);
+#endif
+}
+
+/// Checks if <c> can be part of a word in the completion vocabulary.
+///
+/// Args:
+/// - 'c': The character being checked.
+bool isWordChar(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '-';
+}
+
+/// Counts every word in <text> that is long enough to be worth completing.
+///
+/// Returns a map from each word to the number of times it occurs in <text>.
+///
+/// Args:
+/// - 'text': The text whose words are being counted.
+unordered_map<string, int> tallyWords(const string& text) {
+    unordered_map<string, int> tally;
+    size_t i = 0;
+
+    while (i < text.length()) {
+        while (i < text.length() && !isWordChar(text[i])) i++;
+        const size_t start = i;
+        while (i < text.length() && isWordChar(text[i])) i++;
+
+        if (i - start >= minCompletionLength) {
+            tally[text.substr(start, i - start)]++;
+        }
+    }
+
+    return tally;
+}
+
+/// The vocabulary of every word used across the saved notes, weighted by how
+/// often each word occurs. Used to complete words while editing a note.
+///
+/// Words are kept sorted, so all words sharing a prefix form one contiguous
+/// range that a lookup can walk without touching the rest of the vocabulary.
+///
+/// Attributes:
+/// - 'freqs': Every known word and its total count across all notes.
+/// - 'noteTerms': The word counts each note contributed, so re-saving a note
+///   only adjusts the words of that note instead of rebuilding everything.
+/// - 'loaded': True once the saved notes have been scanned.
+/// - 'bytes': Estimate of the heap memory held by the vocabulary.
+class Vocabulary {
+    private:
+        // Rough per-entry cost of a map node on top of the word itself.
+        static constexpr size_t nodeOverhead = 64;
+
+        map<string, int> freqs;
+        unordered_map<string, unordered_map<string, int>> noteTerms;
+        bool loaded = false;
+        size_t bytes = 0;
+
+    public:
+        bool isLoaded() const { return loaded; }
+        void markLoaded() { loaded = true; }
+        size_t memoryUsage() const { return bytes; }
+
+        /// Drops the whole vocabulary so it is rebuilt on next use.
+        void clear() {
+            freqs.clear();
+            noteTerms.clear();
+            loaded = false;
+            bytes = 0;
+        }
+
+        /// Adds the words of <text> under <title>, replacing whatever the
+        /// note contributed before.
+        void addNote(const string& title, const string& text) {
+            removeNote(title);
+            appendToNote(title, text);
+        }
+
+        /// Adds the words of <text> to what <title> already contributed.
+        void appendToNote(const string& title, const string& text) {
+            auto [terms, newNote] = noteTerms.try_emplace(title);
+            if (newNote) bytes += title.capacity() + nodeOverhead;
+
+            for (const auto& [word, count] : tallyWords(text)) {
+                const auto [entry, newWord] = freqs.try_emplace(word, 0);
+                entry->second += count;
+                if (newWord) bytes += word.capacity() + nodeOverhead;
+
+                const auto [term, newTerm] = terms->second.try_emplace(word, 0);
+                term->second += count;
+                if (newTerm) bytes += word.capacity() + nodeOverhead;
+            }
+        }
+
+        /// Removes every word that <title> contributed.
+        void removeNote(const string& title) {
+            const auto found = noteTerms.find(title);
+            if (found == noteTerms.end()) return;
+
+            for (const auto& [word, count] : found->second) {
+                const auto entry = freqs.find(word);
+                entry->second -= count;
+                bytes -= word.capacity() + nodeOverhead;
+
+                if (entry->second <= 0) {
+                    bytes -= entry->first.capacity() + nodeOverhead;
+                    freqs.erase(entry);
+                }
+            }
+
+            bytes -= found->first.capacity() + nodeOverhead;
+            noteTerms.erase(found);
+        }
+
+        /// Returns up to <limit> words starting with <prefix>, most frequent
+        /// first.
+        vector<string> complete(const string& prefix, size_t limit) const {
+            vector<pair<int, string>> matches;
+
+            for (auto it = freqs.lower_bound(prefix);
+                 it != freqs.end() &&
+                 it->first.compare(0, prefix.length(), prefix) == 0; ++it) {
+                if (it->first != prefix) {
+                    matches.emplace_back(it->second, it->first);
+                }
+            }
+
+            const size_t count = min(limit, matches.size());
+            partial_sort(matches.begin(), matches.begin() + count,
+                         matches.end(), [](const auto& a, const auto& b) {
+                             return a.first > b.first ||
+                                    (a.first == b.first && a.second < b.second);
+                         });
+
+            vector<string> words;
+            for (size_t i = 0; i < count; ++i) {
+                words.push_back(matches[i].second);
+            }
+
+            return words;
+        }
+};
+
+Vocabulary vocabulary; // Completion vocabulary of the saved notes.
+
+/// Gives every note a small number that stays the same for the whole
+/// session, so that sets of notes can be stored as bitmaps.
+///
+/// Attributes:
+/// - 'ids': The number given to each title.
+/// - 'titles': The title of each number, indexed by the number.
+class NoteIds {
+    private:
+        unordered_map<string, uint32_t> ids;
+        vector<string> titles;
+
+    public:
+        /// Returns the number of <title>, giving it one if it has none yet.
+        uint32_t idFor(const string& title) {
+            const auto [entry, inserted] =
+                ids.try_emplace(title, static_cast<uint32_t>(titles.size()));
+            if (inserted) titles.push_back(title);
+            return entry->second;
+        }
+
+        /// Returns true and sets <id> if <title> has a number.
+        bool find(const string& title, uint32_t& id) const {
+            const auto entry = ids.find(title);
+            if (entry == ids.end()) return false;
+            id = entry->second;
+            return true;
+        }
+
+        const string& titleOf(uint32_t id) const { return titles[id]; }
+};
+
+NoteIds noteIds; // Numbers the notes for the bitmap indexes.
+
+/// A compressed set of note numbers, split the way roaring bitmaps are.
+///
+/// Numbers are grouped by their high 16 bits. Each group stores its low
+/// 16 bits either as a sorted array, while the group is sparse, or as a
+/// 65536-bit bitset once it gets dense. Set operations work group by group,
+/// and bitset groups are combined a 64-bit word at a time.
+///
+/// Attributes:
+/// - 'keys': The high 16 bits of each group, sorted.
+/// - 'containers': The low 16 bits of the numbers in each group.
+class Bitmap {
+    private:
+        static constexpr size_t arrayLimit = 4096;
+        static constexpr size_t bitsetWords = 65536 / 64;
+
+        struct Container {
+            vector<uint16_t> array; // Sorted values, while sparse.
+            vector<uint64_t> bits; // One bit per value, once dense.
+            size_t count = 0;
+
+            bool isBitset() const { return !bits.empty(); }
+
+            bool contains(uint16_t low) const {
+                if (isBitset()) return bits[low >> 6] >> (low & 63) & 1;
+                return binary_search(array.begin(), array.end(), low);
+            }
+
+            /// Returns the values as a bitset, converting a copy if needed.
+            vector<uint64_t> asBits() const {
+                if (isBitset()) return bits;
+                vector<uint64_t> words(bitsetWords, 0);
+                for (uint16_t low : array) words[low >> 6] |= 1ULL << (low & 63);
+                return words;
+            }
+
+            /// Picks the cheaper representation for the current values.
+            void normalize() {
+                if (isBitset()) {
+                    count = 0;
+                    for (uint64_t word : bits) count += __builtin_popcountll(word);
+                    if (count > arrayLimit) return;
+
+                    for (size_t i = 0; i < bitsetWords; ++i) {
+                        for (uint64_t word = bits[i]; word; word &= word - 1) {
+                            array.push_back(static_cast<uint16_t>(
+                                i * 64 + __builtin_ctzll(word)));
+                        }
+                    }
+                    bits.clear();
+                    bits.shrink_to_fit();
+                } else {
+                    count = array.size();
+                    if (count <= arrayLimit) return;
+                    bits = asBits();
+                    array.clear();
+                    array.shrink_to_fit();
+                }
+            }
+        };
+
+        vector<uint16_t> keys;
+        vector<Container> containers;
+
+        /// Returns the position of the group for <key>, or where it would go.
+        size_t groupOf(uint16_t key) const {
+            return lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+        }
+
+        static Container intersect(const Container& a, const Container& b) {
+            Container result;
+
+            if (a.isBitset() && b.isBitset()) {
+                result.bits.resize(bitsetWords);
+                for (size_t i = 0; i < bitsetWords; ++i) {
+                    result.bits[i] = a.bits[i] & b.bits[i];
+                }
+            } else if (!a.isBitset() && !b.isBitset()) {
+                set_intersection(a.array.begin(), a.array.end(),
+                                 b.array.begin(), b.array.end(),
+                                 back_inserter(result.array));
+            } else {
+                const Container& sparse = a.isBitset() ? b : a;
+                const Container& dense = a.isBitset() ? a : b;
+                for (uint16_t low : sparse.array) {
+                    if (dense.contains(low)) result.array.push_back(low);
+                }
+            }
+
+            result.normalize();
+            return result;
+        }
+
+        static Container unite(const Container& a, const Container& b) {
+            Container result;
+
+            if (!a.isBitset() && !b.isBitset()) {
+                set_union(a.array.begin(), a.array.end(),
+                          b.array.begin(), b.array.end(),
+                          back_inserter(result.array));
+            } else {
+                result.bits = a.asBits();
+                const vector<uint64_t> other = b.asBits();
+                for (size_t i = 0; i < bitsetWords; ++i) {
+                    result.bits[i] |= other[i];
+                }
+            }
+
+            result.normalize();
+            return result;
+        }
+
+        static Container subtract(const Container& a, const Container& b) {
+            Container result;
+
+            if (!a.isBitset()) {
+                for (uint16_t low : a.array) {
+                    if (!b.contains(low)) result.array.push_back(low);
+                }
+            } else {
+                result.bits = a.bits;
+                const vector<uint64_t> other = b.asBits();
+                for (size_t i = 0; i < bitsetWords; ++i) {
+                    result.bits[i] &= ~other[i];
+                }
+            }
+
+            result.normalize();
+            return result;
+        }
+
+    public:
+        bool empty() const { return keys.empty(); }
+
+        size_t cardinality() const {
+            size_t count = 0;
+            for (const auto& container : containers) count += container.count;
+            return count;
+        }
+
+        size_t memoryUsage() const {
+            size_t bytes = sizeof(Bitmap) + keys.capacity() * sizeof(uint16_t);
+            for (const auto& container : containers) {
+                bytes += sizeof(Container) +
+                         container.array.capacity() * sizeof(uint16_t) +
+                         container.bits.capacity() * sizeof(uint64_t);
+            }
+            return bytes;
+        }
+
+        bool contains(uint32_t id) const {
+            const size_t group = groupOf(id >> 16);
+            return group < keys.size() && keys[group] == id >> 16 &&
+                   containers[group].contains(id & 0xFFFF);
+        }
+
+        void add(uint32_t id) {
+            const uint16_t key = id >> 16;
+            const uint16_t low = id & 0xFFFF;
+            size_t group = groupOf(key);
+
+            if (group == keys.size() || keys[group] != key) {
+                keys.insert(keys.begin() + group, key);
+                containers.insert(containers.begin() + group, Container{});
+            }
+
+            Container& container = containers[group];
+            if (container.isBitset()) {
+                uint64_t& word = container.bits[low >> 6];
+                container.count += !(word >> (low & 63) & 1);
+                word |= 1ULL << (low & 63);
+            } else {
+                const auto pos = lower_bound(container.array.begin(),
+                                             container.array.end(), low);
+                if (pos != container.array.end() && *pos == low) return;
+                container.array.insert(pos, low);
+                container.normalize();
+            }
+        }
+
+        void remove(uint32_t id) {
+            const size_t group = groupOf(id >> 16);
+            if (group == keys.size() || keys[group] != id >> 16) return;
+
+            Container& container = containers[group];
+            const uint16_t low = id & 0xFFFF;
+
+            if (container.isBitset()) {
+                container.bits[low >> 6] &= ~(1ULL << (low & 63));
+            } else {
+                const auto pos = lower_bound(container.array.begin(),
+                                             container.array.end(), low);
+                if (pos == container.array.end() || *pos != low) return;
+                container.array.erase(pos);
+            }
+
+            container.normalize();
+            if (container.count == 0) {
+                keys.erase(keys.begin() + group);
+                containers.erase(containers.begin() + group);
+            }
+        }
+
+        /// Returns the numbers in both this bitmap and <other>.
+        Bitmap operator&(const Bitmap& other) const {
+            Bitmap result;
+
+            for (size_t i = 0, j = 0; i < keys.size() && j < other.keys.size();) {
+                if (keys[i] < other.keys[j]) {
+                    i++;
+                } else if (keys[i] > other.keys[j]) {
+                    j++;
+                } else {
+                    Container both = intersect(containers[i], other.containers[j]);
+                    if (both.count > 0) {
+                        result.keys.push_back(keys[i]);
+                        result.containers.push_back(move(both));
+                    }
+                    i++;
+                    j++;
+                }
+            }
+
+            return result;
+        }
+
+        /// Returns the numbers in this bitmap, <other>, or both.
+        Bitmap operator|(const Bitmap& other) const {
+            Bitmap result;
+            size_t i = 0;
+            size_t j = 0;
+
+            while (i < keys.size() || j < other.keys.size()) {
+                if (j == other.keys.size() ||
+                    (i < keys.size() && keys[i] < other.keys[j])) {
+                    result.keys.push_back(keys[i]);
+                    result.containers.push_back(containers[i++]);
+                } else if (i == keys.size() || keys[i] > other.keys[j]) {
+                    result.keys.push_back(other.keys[j]);
+                    result.containers.push_back(other.containers[j++]);
+                } else {
+                    result.keys.push_back(keys[i]);
+                    result.containers.push_back(
+                        unite(containers[i++], other.containers[j++]));
+                }
+            }
+
+            return result;
+        }
+
+        /// Returns the numbers in this bitmap that are not in <other>.
+        Bitmap operator-(const Bitmap& other) const {
+            Bitmap result;
+
+            for (size_t i = 0, j = 0; i < keys.size(); ++i) {
+                while (j < other.keys.size() && other.keys[j] < keys[i]) j++;
+
+                Container rest = (j < other.keys.size() && other.keys[j] == keys[i])
+                    ? subtract(containers[i], other.containers[j])
+                    : containers[i];
+                if (rest.count > 0) {
+                    result.keys.push_back(keys[i]);
+                    result.containers.push_back(move(rest));
+                }
+            }
+
+            return result;
+        }
+
+        /// Returns every number in the bitmap, in increasing order.
+        vector<uint32_t> values() const {
+            vector<uint32_t> ids;
+            ids.reserve(cardinality());
+
+            for (size_t i = 0; i < keys.size(); ++i) {
+                const uint32_t high = static_cast<uint32_t>(keys[i]) << 16;
+                const Container& container = containers[i];
+
+                if (container.isBitset()) {
+                    for (size_t w = 0; w < bitsetWords; ++w) {
+                        for (uint64_t word = container.bits[w]; word;
+                             word &= word - 1) {
+                            ids.push_back(high | (w * 64 + __builtin_ctzll(word)));
+                        }
+                    }
+                } else {
+                    for (uint16_t low : container.array) ids.push_back(high | low);
+                }
+            }
+
+            return ids;
+        }
+};
+
+/// Returns <text> with every letter lowercased.
+///
+/// Args:
+/// - 'text': The text being lowercased.
+string toLower(string text) {
+    transform(text.begin(), text.end(), text.begin(), [](char c) {
+        return static_cast<char>(tolower(static_cast<unsigned char>(c)));
+    });
+    return text;
+}
+
+/// Finds every '#tag' in <text>. A tag is a '#' at the start of a word
+/// followed directly by letters, digits, '_', '-' or '/'. Tags are
+/// lowercased, so '#Ops' and '#ops' are the same tag.
+///
+/// Returns the set of tags in <text>, without their '#'.
+///
+/// Args:
+/// - 'text': The text being searched for tags.
+set<string> extractTags(const string& text) {
+    set<string> tags;
+
+    for (size_t i = 0; i < text.length(); ++i) {
+        if (text[i] != '#' || (i > 0 && !isspace(static_cast<unsigned char>(
+                                            text[i - 1])))) {
+            continue;
+        }
+
+        size_t end = i + 1;
+        while (end < text.length() &&
+               (isWordChar(text[end]) || text[end] == '/')) {
+            end++;
+        }
+
+        if (end > i + 1) {
+            tags.insert(toLower(text.substr(i + 1, end - i - 1)));
+        }
+
+        i = end - 1;
+    }
+
+    return tags;
+}
+
+/// Finds every word in <text> for the full text index. Words are
+/// lowercased, and single characters are left out.
+///
+/// Returns the set of words in <text>.
+///
+/// Args:
+/// - 'text': The text being split into words.
+set<string> extractTerms(const string& text) {
+    set<string> terms;
+    size_t i = 0;
+
+    while (i < text.length()) {
+        while (i < text.length() && !isWordChar(text[i])) i++;
+        const size_t start = i;
+        while (i < text.length() && isWordChar(text[i])) i++;
+
+        if (i - start >= 2) terms.insert(toLower(text.substr(start, i - start)));
+    }
+
+    return terms;
+}
+
+/// Counts every word in <text> the way 'extractTerms' finds them.
+///
+/// Returns a map from each word to the number of times it occurs in <text>.
+unordered_map<string, int> countTerms(const string& text) {
+    unordered_map<string, int> counts;
+    size_t i = 0;
+
+    while (i < text.length()) {
+        while (i < text.length() && !isWordChar(text[i])) i++;
+        const size_t start = i;
+        while (i < text.length() && isWordChar(text[i])) i++;
+
+        if (i - start >= 2) counts[toLower(text.substr(start, i - start))]++;
+    }
+
+    return counts;
+}
+
+/// Maps every key (a tag or a word) to the bitmap of the notes that
+/// contain it.
+///
+/// Attributes:
+/// - 'postings': The notes containing each key.
+/// - 'noteKeys': The keys of each note, so an update only flips the bits of
+///   keys the note gained or lost.
+class PostingIndex {
+    private:
+        map<string, Bitmap> postings;
+        unordered_map<uint32_t, set<string>> noteKeys;
+
+    public:
+        /// Makes <keys> the keys of note <id>.
+        ///
+        /// Returns true if the note's keys changed.
+        bool setKeys(uint32_t id, const set<string>& keys) {
+            set<string>& current = noteKeys[id];
+            if (current == keys) {
+                if (current.empty()) noteKeys.erase(id);
+                return false;
+            }
+
+            for (const auto& key : current) {
+                if (keys.count(key)) continue;
+
+                Bitmap& notes = postings[key];
+                notes.remove(id);
+                if (notes.empty()) postings.erase(key);
+            }
+
+            for (const auto& key : keys) {
+                if (!current.count(key)) postings[key].add(id);
+            }
+
+            current = keys;
+            if (current.empty()) noteKeys.erase(id);
+            return true;
+        }
+
+        /// Adds <keys> to the keys note <id> already has.
+        ///
+        /// Returns true if the note's keys changed.
+        bool addKeys(uint32_t id, const set<string>& keys) {
+            set<string> merged = keys;
+            const auto current = noteKeys.find(id);
+            if (current != noteKeys.end()) {
+                merged.insert(current->second.begin(), current->second.end());
+            }
+            return setKeys(id, merged);
+        }
+
+        /// Returns the notes containing <key>.
+        const Bitmap& notesWith(const string& key) const {
+            static const Bitmap none;
+            const auto found = postings.find(key);
+            return found == postings.end() ? none : found->second;
+        }
+
+        /// Returns every note that has at least one key.
+        Bitmap allNotes() const {
+            Bitmap all;
+            for (const auto& [id, keys] : noteKeys) all.add(id);
+            return all;
+        }
+
+        void clear() {
+            postings.clear();
+            noteKeys.clear();
+        }
+
+        size_t memoryUsage() const {
+            size_t bytes = 0;
+            for (const auto& [key, notes] : postings) {
+                bytes += key.capacity() + notes.memoryUsage() + 64;
+            }
+            for (const auto& [id, keys] : noteKeys) {
+                bytes += 64;
+                for (const auto& key : keys) bytes += key.capacity() + 64;
+            }
+            return bytes;
+        }
+};
+
+PostingIndex tagIndex; // Tags of the saved notes.
+PostingIndex wordIndex; // Words of the saved notes, for full text queries.
+
+/// The words of every note as a sparse TF-IDF vector, used to find the
+/// notes most like a given one by cosine similarity.
+///
+/// Each note keeps the count of each of its words, as parallel arrays
+/// sorted by word number, so saving a note only replaces that note's
+/// vector. Word weights depend on how many notes use each word, so they and
+/// the vector lengths are worked out again, in parallel, on the first
+/// lookup after any change.
+///
+/// A lookup doesn't compare against every note. The note's rarest words
+/// pick the candidates from each word's posting bitmap, and the note's
+/// weights are spread into a dense array so each candidate is scored with a
+/// single gather loop over its own words.
+///
+/// Attributes:
+/// - 'termIds': The number given to each word.
+/// - 'postings': The notes using each word, by word number.
+/// - 'vectors': The words of each note and their weighted counts.
+/// - 'idf': The inverse document frequency of each word.
+/// - 'norms': The length of each note's TF-IDF vector.
+/// - 'stale': True if 'idf' and 'norms' are out of date.
+class SimilarityIndex {
+    private:
+        struct TermVector {
+            vector<uint32_t> terms;
+            vector<float> counts; // 1 + ln(count), the damped term frequency.
+            vector<uint32_t> raw; // The plain counts, for appends.
+        };
+
+        unordered_map<string, uint32_t> termIds;
+        vector<Bitmap> postings;
+        unordered_map<uint32_t, TermVector> vectors;
+        vector<float> idf;
+        unordered_map<uint32_t, float> norms;
+        bool stale = true;
+
+        /// Works out every word's weight and every note's vector length.
+        void refresh() {
+            const double total = static_cast<double>(vectors.size());
+            idf.assign(postings.size(), 0);
+            for (size_t term = 0; term < postings.size(); ++term) {
+                const size_t notes = postings[term].cardinality();
+                if (notes > 0) idf[term] = static_cast<float>(log(1 + total / notes));
+            }
+
+            vector<pair<const uint32_t, TermVector>*> notes;
+            for (auto& entry : vectors) notes.push_back(&entry);
+            vector<float> lengths(notes.size());
+
+            runParallel(notes.size(), [&](size_t i) {
+                const TermVector& vec = notes[i]->second;
+                float sum = 0;
+                for (size_t k = 0; k < vec.terms.size(); ++k) {
+                    const float weight = vec.counts[k] * idf[vec.terms[k]];
+                    sum += weight * weight;
+                }
+                lengths[i] = sqrt(sum);
+            });
+
+            norms.clear();
+            for (size_t i = 0; i < notes.size(); ++i) norms[notes[i]->first] = lengths[i];
+            stale = false;
+        }
+
+        /// Numbers the words of <counts>, keeping the counts sorted by number.
+        map<uint32_t, uint32_t> number(const unordered_map<string, int>& counts) {
+            map<uint32_t, uint32_t> numbered;
+            for (const auto& [word, count] : counts) {
+                const auto [entry, added] = termIds.try_emplace(word, postings.size());
+                if (added) postings.emplace_back();
+                numbered[entry->second] += count;
+            }
+            return numbered;
+        }
+
+        /// Makes <counts> the vector of note <id>.
+        void store(uint32_t id, const map<uint32_t, uint32_t>& counts) {
+            removeNote(id);
+            if (counts.empty()) return;
+
+            TermVector& vec = vectors[id];
+            for (const auto& [term, count] : counts) {
+                postings[term].add(id);
+                vec.terms.push_back(term);
+                vec.counts.push_back(1 + log(static_cast<float>(count)));
+                vec.raw.push_back(count);
+            }
+            stale = true;
+        }
+
+    public:
+        /// Makes <counts> the word counts of note <id>.
+        void setNote(uint32_t id, const unordered_map<string, int>& counts) {
+            store(id, number(counts));
+        }
+
+        /// Adds <counts> to the word counts note <id> already has.
+        void addToNote(uint32_t id, const unordered_map<string, int>& counts) {
+            map<uint32_t, uint32_t> merged = number(counts);
+            const auto found = vectors.find(id);
+
+            if (found != vectors.end()) {
+                for (size_t k = 0; k < found->second.terms.size(); ++k) {
+                    merged[found->second.terms[k]] += found->second.raw[k];
+                }
+            }
+
+            store(id, merged);
+        }
+
+        void removeNote(uint32_t id) {
+            const auto found = vectors.find(id);
+            if (found == vectors.end()) return;
+
+            for (uint32_t term : found->second.terms) postings[term].remove(id);
+            vectors.erase(found);
+            stale = true;
+        }
+
+        /// Returns up to <limit> notes most like note <id>, best first, with
+        /// their cosine similarity.
+        vector<pair<float, uint32_t>> related(uint32_t id, size_t limit) {
+            const auto found = vectors.find(id);
+            if (found == vectors.end()) return {};
+            if (stale) refresh();
+
+            const TermVector& query = found->second;
+            const float queryNorm = norms[id];
+            if (queryNorm == 0) return {};
+
+            // Candidates share at least one of the note's rarest words;
+            // words in most notes say little about what a note is about.
+            vector<size_t> order(query.terms.size());
+            iota(order.begin(), order.end(), 0);
+            const size_t picked = min(relatedQueryTerms, order.size());
+            partial_sort(order.begin(), order.begin() + picked, order.end(),
+                         [&](size_t a, size_t b) {
+                             return query.counts[a] * idf[query.terms[a]] >
+                                    query.counts[b] * idf[query.terms[b]];
+                         });
+
+            Bitmap candidates;
+            for (size_t i = 0; i < picked; ++i) {
+                candidates = candidates | postings[query.terms[order[i]]];
+            }
+            candidates.remove(id);
+
+            vector<float> dense(postings.size(), 0);
+            for (size_t k = 0; k < query.terms.size(); ++k) {
+                const float weight = idf[query.terms[k]];
+                dense[query.terms[k]] = query.counts[k] * weight * weight;
+            }
+
+            vector<pair<float, uint32_t>> scores;
+            for (uint32_t other : candidates.values()) {
+                const TermVector& vec = vectors.at(other);
+                const float norm = norms[other];
+                if (norm == 0) continue;
+
+                float dot = 0;
+                for (size_t k = 0; k < vec.terms.size(); ++k) {
+                    dot += vec.counts[k] * dense[vec.terms[k]];
+                }
+                if (dot > 0) scores.emplace_back(dot / (norm * queryNorm), other);
+            }
+
+            const size_t count = min(limit, scores.size());
+            partial_sort(scores.begin(), scores.begin() + count, scores.end(),
+                         [](const auto& a, const auto& b) {
+                             return a.first > b.first ||
+                                    (a.first == b.first && a.second < b.second);
+                         });
+            scores.resize(count);
+            return scores;
+        }
+
+        void clear() {
+            termIds.clear();
+            postings.clear();
+            vectors.clear();
+            idf.clear();
+            norms.clear();
+            stale = true;
+        }
+
+        size_t memoryUsage() const {
+            size_t bytes = idf.capacity() * sizeof(float) + norms.size() * 32;
+            for (const auto& [word, term] : termIds) bytes += word.capacity() + 64;
+            for (const auto& notes : postings) bytes += notes.memoryUsage();
+            for (const auto& [id, vec] : vectors) {
+                bytes += 64 + vec.terms.capacity() * sizeof(uint32_t) +
+                         vec.counts.capacity() * sizeof(float) +
+                         vec.raw.capacity() * sizeof(uint32_t);
+            }
+            return bytes;
+        }
+};
+
+SimilarityIndex similarity; // Word vectors of the saved notes, for 'related'.
+
+/// A trie of every saved note's title, used to suggest titles close to a
+/// misspelled one.
+///
+/// Suggestions are found by running a Levenshtein automaton for the typed
+/// title alongside a walk of the trie. The automaton's state is one row of
+/// the edit distance table, shared by every title under the current trie
+/// node, and a whole branch is skipped as soon as no title in it can be
+/// close enough. Only a small part of the trie is visited however many
+/// titles there are.
+///
+/// Attributes:
+/// - 'nodes': The trie nodes; node 0 is the root.
+/// - 'loaded': True once the save directory has been scanned.
+/// - 'bytes': Estimate of the memory held by the trie.
+class TitleTrie {
+    private:
+        struct Node {
+            vector<pair<char, uint32_t>> children; // Sorted by character.
+            bool isTitle = false;
+        };
+
+        vector<Node> nodes = vector<Node>(1);
+        bool loaded = false;
+        size_t bytes = sizeof(Node);
+
+        /// Continues the walk from <node>, whose path spells <prefix> and
+        /// whose automaton state is <row>.
+        void walk(uint32_t node, string& prefix, const vector<size_t>& row,
+                  const string& target, size_t maxDistance,
+                  vector<pair<size_t, string>>& found) const {
+            if (nodes[node].isTitle && row.back() <= maxDistance) {
+                found.emplace_back(row.back(), prefix);
+            }
+
+            for (const auto& [c, child] : nodes[node].children) {
+                vector<size_t> next(row.size());
+                next[0] = row[0] + 1;
+                size_t best = next[0];
+
+                for (size_t i = 1; i < row.size(); ++i) {
+                    const size_t replace = row[i - 1] + (target[i - 1] != c);
+                    next[i] = min({next[i - 1] + 1, row[i] + 1, replace});
+                    best = min(best, next[i]);
+                }
+
+                // No title below this node can be close enough.
+                if (best > maxDistance) continue;
+
+                prefix.push_back(c);
+                walk(child, prefix, next, target, maxDistance, found);
+                prefix.pop_back();
+            }
+        }
+
+    public:
+        bool isLoaded() const { return loaded; }
+        void markLoaded() { loaded = true; }
+        size_t memoryUsage() const { return bytes; }
+
+        void clear() {
+            nodes.assign(1, Node{});
+            loaded = false;
+            bytes = sizeof(Node);
+        }
+
+        void insert(const string& title) {
+            uint32_t node = 0;
+
+            for (char c : title) {
+                auto& children = nodes[node].children;
+                auto pos = lower_bound(children.begin(), children.end(),
+                                       make_pair(c, uint32_t{0}));
+
+                if (pos == children.end() || pos->first != c) {
+                    const auto child = static_cast<uint32_t>(nodes.size());
+                    children.insert(pos, {c, child});
+                    nodes.emplace_back();
+                    bytes += sizeof(Node) + sizeof(pair<char, uint32_t>);
+                    node = child;
+                } else {
+                    node = pos->second;
+                }
+            }
+
+            nodes[node].isTitle = true;
+        }
+
+        /// Unmarks <title>. Its nodes stay until the trie is rebuilt.
+        void remove(const string& title) {
+            uint32_t node = 0;
+
+            for (char c : title) {
+                const auto& children = nodes[node].children;
+                const auto pos = lower_bound(children.begin(), children.end(),
+                                             make_pair(c, uint32_t{0}));
+                if (pos == children.end() || pos->first != c) return;
+                node = pos->second;
+            }
+
+            nodes[node].isTitle = false;
+        }
+
+        /// Returns up to <limit> titles within <maxDistance> edits of
+        /// <target>, closest first.
+        vector<string> closest(const string& target, size_t maxDistance,
+                               size_t limit) const {
+            vector<size_t> row(target.length() + 1);
+            for (size_t i = 0; i < row.size(); ++i) row[i] = i;
+
+            vector<pair<size_t, string>> found;
+            string prefix;
+            walk(0, prefix, row, target, maxDistance, found);
+
+            sort(found.begin(), found.end());
+            vector<string> titles;
+            for (size_t i = 0; i < found.size() && i < limit; ++i) {
+                titles.push_back(found[i].second);
+            }
+
+            return titles;
+        }
+};
+
+TitleTrie titleTrie; // Titles of the saved notes, for typo suggestions.
+
+/// Reads the creation time out of a note's head timestamp, such as
+/// '2026-10-18 [14:05]'.
+///
+/// Returns the time in minutes since the epoch, or 0 if <timestamp> can't
+/// be read.
+///
+/// Args:
+/// - 'timestamp': The timestamp part of a note's head.
+uint32_t parseTimestamp(const string& timestamp) {
+    tm local_tm = {};
+    istringstream stream(timestamp);
+    stream >> get_time(&local_tm, "%Y-%m-%d [%H:%M]");
+    if (stream.fail()) return 0;
+
+    local_tm.tm_isdst = -1;
+    const time_t seconds = mktime(&local_tm);
+    return seconds < 0 ? 0 : static_cast<uint32_t>(seconds / 60);
+}
+
+/// Appends <value> to <out> as a varint (7 bits per byte, low bits first).
+void appendVarint(vector<char>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+/// Reads a varint written by appendVarint into <value> and moves <pos>
+/// past it, reading no further than <end>.
+///
+/// Returns false if the varint is cut off by <end> or too long.
+bool readVarint(const char*& pos, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < end; shift += 7) {
+        const auto byte = static_cast<unsigned char>(*pos++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+/// Compresses <input> with a small LZ77 scheme: the output is a series of
+/// literal runs, each followed by a back-reference to an earlier copy of
+/// the bytes that come next. Matches are found through a hash table of
+/// recently seen 4-byte sequences, so compression is a single fast pass.
+///
+/// Returns the compressed bytes, starting with the size of <input>.
+///
+/// Args:
+/// - 'input': The bytes being compressed.
+string compressBlock(const string& input) {
+    const size_t minMatch = 4;
+    const size_t maxOffset = 1 << 16;
+    vector<uint32_t> table(1 << 14, UINT32_MAX);
+    vector<char> output;
+    size_t anchor = 0;
+    size_t i = 0;
+
+    appendVarint(output, static_cast<uint32_t>(input.size()));
+
+    const auto read32 = [&](size_t pos) {
+        uint32_t value;
+        memcpy(&value, input.data() + pos, 4);
+        return value;
+    };
+
+    while (i + minMatch <= input.size()) {
+        const uint32_t hash = (read32(i) * 2654435761U) >> 18;
+        const uint32_t candidate = table[hash];
+        table[hash] = static_cast<uint32_t>(i);
+
+        if (candidate == UINT32_MAX || i - candidate > maxOffset ||
+            read32(candidate) != read32(i)) {
+            i++;
+            continue;
+        }
+
+        size_t length = minMatch;
+        while (i + length < input.size() &&
+               input[candidate + length] == input[i + length]) {
+            length++;
+        }
+
+        appendVarint(output, static_cast<uint32_t>(i - anchor));
+        output.insert(output.end(), input.begin() + anchor, input.begin() + i);
+        appendVarint(output, static_cast<uint32_t>(length - minMatch));
+        appendVarint(output, static_cast<uint32_t>(i - candidate));
+
+        i += length;
+        anchor = i;
+    }
+
+    appendVarint(output, static_cast<uint32_t>(input.size() - anchor));
+    output.insert(output.end(), input.begin() + anchor, input.end());
+    return string(output.begin(), output.end());
+}
+
+/// Reverses compressBlock.
+///
+/// Returns false if <input> is not valid compressed data.
+///
+/// Args:
+/// - 'input': The compressed bytes.
+/// - 'output': Set to the original bytes.
+bool decompressBlock(const string& input, string& output) {
+    const char* pos = input.data();
+    const char* end = input.data() + input.size();
+    uint64_t size = 0;
+    output.clear();
+    if (!readVarint(pos, end, size) || size > maxBlockSize) return false;
+    output.reserve(size);
+
+    // Every run is checked against the size in the header, so corrupt
+    // data can't make the output grow past it.
+    while (pos < end) {
+        uint64_t literals = 0;
+        if (!readVarint(pos, end, literals) ||
+            literals > static_cast<size_t>(end - pos) ||
+            literals > size - output.size()) {
+            return false;
+        }
+        output.append(pos, literals);
+        pos += literals;
+        if (pos >= end) break;
+
+        uint64_t length = 0;
+        uint64_t offset = 0;
+        if (!readVarint(pos, end, length) || !readVarint(pos, end, offset) ||
+            length + 4 > size - output.size() || offset == 0 ||
+            offset > output.size()) {
+            return false;
+        }
+
+        // Copy a byte at a time, since a match may overlap its own output.
+        const size_t from = output.size() - offset;
+        for (uint64_t i = 0; i < length + 4; ++i) output.push_back(output[from + i]);
+    }
+
+    return output.size() == size;
+}
+
+/// A sealed segment of a log note.
+///
+/// Attributes:
+/// - 'number': The segment's place in the log; also its file name.
+/// - 'rawSize': The size of the segment's text.
+/// - 'storedSize': The size of the segment's file.
+/// - 'compressed': True if the file holds compressBlock output.
+struct LogSegment {
+    uint32_t number = 0;
+    uint64_t rawSize = 0;
+    uint64_t storedSize = 0;
+    bool compressed = false;
+};
+
+/// A note kept as an append-only log, for notes that only ever grow.
+///
+/// The log lives in a '<title>.cppnlog' directory. Its body is split into
+/// segment files of about 'logSegmentSize' bytes, cut at line ends. Only
+/// the last segment, the tail, is ever written; once full it is sealed and
+/// a new tail is started. An index file holds the note's head and the list
+/// of sealed segments, so appending and showing the end of the log only
+/// touch the tail, and sealed segments can be compressed one at a time.
+///
+/// Attributes:
+/// - 'dir': The log's directory.
+/// - 'head': The note's head line.
+/// - 'sealed': The sealed segments, in order.
+class LogNote {
+    private:
+        fs::path dir;
+        string head;
+        vector<LogSegment> sealed;
+
+        fs::path segmentPath(uint32_t number, bool compressed) const {
+            char name[16];
+            snprintf(name, sizeof(name), "%08u", number);
+            return dir / (string(name) + (compressed ? ".segz" : ".seg"));
+        }
+
+        uint32_t tailNumber() const {
+            return sealed.empty() ? 0 : sealed.back().number + 1;
+        }
+
+        fs::path tailPath() const { return segmentPath(tailNumber(), false); }
+
+        /// Writes the index, replacing the old one atomically.
+        bool writeIndex() const {
+            const fs::path tempPath = dir / "index.tmp";
+            ofstream outfile(tempPath);
+            outfile << head << "\n";
+
+            for (const auto& segment : sealed) {
+                outfile << segment.number << " " << segment.rawSize << " "
+                        << segment.storedSize << " " << segment.compressed
+                        << "\n";
+            }
+
+            outfile.close();
+            if (!outfile) return false;
+
+            error_code error;
+            fs::rename(tempPath, dir / "index", error);
+            return !error;
+        }
+
+        /// Reads the text of <segment> into <text>, decompressing it if
+        /// needed.
+        ///
+        /// Returns false if the file is missing, short or corrupt.
+        bool readSegment(const LogSegment& segment, string& text) const {
+            ifstream infile(segmentPath(segment.number, segment.compressed),
+                            ios::binary);
+            stringstream ss;
+            ss << infile.rdbuf();
+            text.clear();
+
+            if (!infile.is_open()) return false;
+            if (!segment.compressed) {
+                text = ss.str();
+            } else if (!decompressBlock(ss.str(), text)) {
+                return false;
+            }
+            return text.size() == segment.rawSize;
+        }
+
+        /// Returns the text of <segment>. A segment that can't be read back
+        /// is logged and shown as a line saying so, not as missing text.
+        string segmentOrNotice(const LogSegment& segment) const {
+            string text;
+            if (readSegment(segment, text)) return text;
+
+            logger.log(LogLevel::Error, "segment_unreadable", {
+                {"path", segmentPath(segment.number, segment.compressed).string()}});
+            return "[segment " + to_string(segment.number) + " of this log note "
+                   "is damaged and was skipped]\n";
+        }
+
+    public:
+        static fs::path pathOf(const string& title) {
+            return saveDir / (title + logExt);
+        }
+
+        static bool exists(const string& title) {
+            return fs::is_directory(pathOf(title));
+        }
+
+        const string& getHead() const { return head; }
+        size_t segmentCount() const { return sealed.size() + 1; }
+
+        /// Reads the index of log note <title>. Returns false if it can't.
+        bool load(const string& title) {
+            dir = pathOf(title);
+            ifstream infile(dir / "index");
+            if (!getline(infile, head)) return false;
+
+            sealed.clear();
+            LogSegment segment;
+            while (infile >> segment.number >> segment.rawSize >>
+                   segment.storedSize >> segment.compressed) {
+                sealed.push_back(segment);
+            }
+
+            return true;
+        }
+
+        /// Makes a new, empty log note <title> with head line <headLine>.
+        bool create(const string& title, const string& headLine) {
+            dir = pathOf(title);
+            head = headLine;
+            sealed.clear();
+
+            error_code error;
+            fs::create_directories(dir, error);
+            ofstream tail(tailPath(), ios::binary);
+            return !error && tail.is_open() && writeIndex();
+        }
+
+        uint64_t tailSize() const {
+            error_code error;
+            const uintmax_t size = fs::file_size(tailPath(), error);
+            return error ? 0 : size;
+        }
+
+        /// Returns the size of the log's text.
+        uint64_t size() const {
+            uint64_t total = tailSize();
+            for (const auto& segment : sealed) total += segment.rawSize;
+            return total;
+        }
+
+        /// Appends <text> to the tail, sealing it and starting a new one
+        /// each time it fills up.
+        bool append(const string& text) {
+            size_t done = 0;
+            uint64_t tail = tailSize();
+
+            while (done < text.size()) {
+                const size_t room = logSegmentSize > tail ? logSegmentSize - tail : 0;
+                size_t cut = text.size() - done;
+
+                if (cut > room) {
+                    // Fill the tail up to its last whole line, or cut mid-line
+                    // if a single line is bigger than a segment.
+                    const size_t lineEnd = room == 0 ? string::npos
+                        : text.rfind('\n', done + room - 1);
+                    cut = lineEnd != string::npos && lineEnd >= done
+                        ? lineEnd + 1 - done
+                        : (tail == 0 ? room : 0);
+                }
+
+                if (cut > 0) {
+                    ofstream outfile(tailPath(), ios::app | ios::binary);
+                    outfile.write(text.data() + done, cut);
+                    if (!outfile) return false;
+                    metrics.bytesWritten.fetch_add(cut, memory_order_relaxed);
+                    done += cut;
+                    tail += cut;
+                }
+
+                if (done < text.size()) {
+                    sealed.push_back({tailNumber(), tail, tail, false});
+                    tail = 0;
+                    ofstream newTail(tailPath(), ios::binary);
+                    if (!newTail.is_open() || !writeIndex()) return false;
+                }
+            }
+
+            return true;
+        }
+
+        /// Returns up to the last <maxBytes> of the log, read only from the
+        /// last segment that has any text.
+        string readTail(size_t maxBytes) const {
+            const uint64_t size = tailSize();
+
+            if (size == 0 && !sealed.empty()) {
+                const string text = segmentOrNotice(sealed.back());
+                return text.substr(text.size() - min(text.size(), maxBytes));
+            }
+
+            string window(min<uint64_t>(size, maxBytes), '\0');
+            ifstream infile(tailPath(), ios::binary);
+            infile.seekg(size - window.size());
+            infile.read(&window[0], window.size());
+            return window;
+        }
+
+        /// Returns the text of sealed segment <i>, or of the tail if <i> is
+        /// 'sealedCount()'.
+        string segmentText(size_t i) const {
+            if (i < sealed.size()) return segmentOrNotice(sealed[i]);
+
+            string text(tailSize(), '\0');
+            ifstream infile(tailPath(), ios::binary);
+            infile.read(&text[0], text.size());
+            return text;
+        }
+
+        /// Calls <consume> with the text of each segment, in order.
+        void forEachSegment(const function<void(const string&)>& consume) const {
+            for (const auto& segment : sealed) consume(segmentOrNotice(segment));
+            if (tailSize() > 0) consume(segmentText(sealed.size()));
+        }
+
+        /// Returns where the log ends: its number of sealed segments and
+        /// the size of its tail.
+        pair<size_t, uint64_t> snapshot() const { return {sealed.size(), tailSize()}; }
+
+        /// Cuts the log back to a point returned by snapshot().
+        bool restore(pair<size_t, uint64_t> point) {
+            error_code error;
+            if (sealed.size() > point.first) {
+                fs::remove(tailPath(), error);
+                while (sealed.size() > point.first + 1) {
+                    fs::remove(segmentPath(sealed.back().number, false), error);
+                    sealed.pop_back();
+                }
+                sealed.pop_back();
+                if (!writeIndex()) return false;
+            }
+
+            fs::resize_file(tailPath(), point.second, error);
+            return !error;
+        }
+
+        /// Removes every segment, leaving an empty log.
+        bool reset() {
+            error_code error;
+            for (const auto& segment : sealed) {
+                fs::remove(segmentPath(segment.number, segment.compressed), error);
+            }
+            fs::remove(tailPath(), error);
+            sealed.clear();
+
+            ofstream tail(tailPath(), ios::binary);
+            return tail.is_open() && writeIndex();
+        }
+
+        /// Compresses every sealed segment that isn't yet.
+        ///
+        /// Returns the number of bytes saved on disk.
+        uint64_t compressSealed() {
+            uint64_t saved = 0;
+
+            for (size_t i = 0; i < sealed.size(); ++i) {
+                if (!compressSegment(i, saved)) break;
+            }
+
+            return saved;
+        }
+
+        size_t sealedCount() const { return sealed.size(); }
+        const LogSegment& segment(size_t i) const { return sealed[i]; }
+
+        /// Compresses sealed segment <i> if it isn't yet and it shrinks,
+        /// adding the bytes saved to <saved>.
+        ///
+        /// Returns false if the index could not be written.
+        bool compressSegment(size_t i, uint64_t& saved) {
+            LogSegment& segment = sealed[i];
+            if (segment.compressed) return true;
+
+            string text;
+            if (!readSegment(segment, text)) return true;
+
+            const string packed = compressBlock(text);
+            if (packed.size() >= segment.storedSize) return true;
+
+            ofstream outfile(segmentPath(segment.number, true), ios::binary);
+            outfile.write(packed.data(), packed.size());
+            outfile.close();
+            if (!outfile) return true;
+
+            const fs::path rawPath = segmentPath(segment.number, false);
+            saved += segment.storedSize - packed.size();
+            segment.storedSize = packed.size();
+            segment.compressed = true;
+
+            // The raw file goes only once the index points past it.
+            if (!writeIndex()) return false;
+            error_code error;
+            fs::remove(rawPath, error);
+            return true;
+        }
+
+        /// Checks that sealed segment <i> can still be read back whole.
+        bool verifySegment(size_t i) const {
+            const LogSegment& segment = sealed[i];
+            error_code error;
+            const uintmax_t stored = fs::file_size(
+                segmentPath(segment.number, segment.compressed), error);
+            if (error || stored != segment.storedSize) return false;
+            if (!segment.compressed) return true;
+
+            ifstream infile(segmentPath(segment.number, true), ios::binary);
+            stringstream ss;
+            ss << infile.rdbuf();
+            string text;
+            return decompressBlock(ss.str(), text) && text.size() == segment.rawSize;
+        }
+};
+
+/// A frame of a packed note.
+///
+/// Attributes:
+/// - 'offset', 'size': Where the compressed frame is in the file.
+/// - 'rawOffset', 'rawSize': Where its text is in the note.
+/// - 'firstLine': The line the frame starts in, counting from 1.
+struct PackedFrame {
+    uint64_t offset;
+    uint64_t size;
+    uint64_t rawOffset;
+    uint64_t rawSize;
+    uint64_t firstLine;
+};
+
+/// A plain note compressed into independent frames, for big notes that are
+/// mostly read in pieces.
+///
+/// Each frame holds about 'packedFrameSize' bytes of text cut at a line end
+/// and is compressed on its own. A frame index at the end of the file maps
+/// offsets and line numbers to frames, so reading a range, a few lines or
+/// the tail only decompresses the frames it touches. The file is the magic
+/// line, the frames, the index, and a fixed trailer pointing at the index.
+///
+/// Appends and truncations rewrite only the last frame, if it is short,
+/// and the index, but do so in a copy of the file that is then renamed over
+/// it, so a failed or interrupted write leaves the note as it was. Loading
+/// checks that the index fits the file, so a damaged one is refused rather
+/// than trusted.
+///
+/// Attributes:
+/// - 'path': The note's file.
+/// - 'frames': The frame index.
+/// - 'rawSize': The size of the note's text, head included.
+/// - 'lines': The number of line ends in the note.
+class PackedNote {
+    private:
+        static constexpr const char* magic = "CPPNZ1\n";
+        static constexpr size_t magicSize = 7;
+        static constexpr size_t trailerSize = 24;
+        static constexpr size_t minIndexLine = 10; // "0 0 0 0 0\n"
+
+        // compressBlock output is never more than 5 bytes per 4 of input,
+        // plus a few varints.
+        static constexpr uint64_t maxFrameSize = packedFrameSize + packedFrameSize / 4 + 32;
+
+        fs::path path;
+        vector<PackedFrame> frames;
+        uint64_t rawSize = 0;
+        uint64_t lines = 0;
+
+        uint64_t dataEnd() const {
+            return frames.empty() ? magicSize
+                                  : frames.back().offset + frames.back().size;
+        }
+
+        /// Reads and decompresses frame <i> into <text>.
+        ///
+        /// Returns false if the frame can't be read or is corrupt.
+        bool readFrame(size_t i, string& text) const {
+            ifstream infile(path, ios::binary);
+            string packed(frames[i].size, '\0');
+            infile.seekg(frames[i].offset);
+            infile.read(&packed[0], packed.size());
+
+            if (!infile || !decompressBlock(packed, text) ||
+                text.size() != frames[i].rawSize) {
+                text.clear();
+                logger.log(LogLevel::Error, "frame_unreadable", {
+                    {"path", path.string()}, {"frame", to_string(i)}});
+                return false;
+            }
+            metrics.bytesRead.fetch_add(packed.size(), memory_order_relaxed);
+            return true;
+        }
+
+        /// Returns the text of frame <i>, or nothing if it can't be read.
+        string frameText(size_t i) const {
+            string text;
+            readFrame(i, text);
+            return text;
+        }
+
+        /// Returns the frame holding byte <offset> of the note's text.
+        size_t frameAt(uint64_t offset) const {
+            const auto after = upper_bound(
+                frames.begin(), frames.end(), offset,
+                [](uint64_t value, const PackedFrame& frame) {
+                    return value < frame.rawOffset;
+                });
+            return after == frames.begin() ? 0 : after - frames.begin() - 1;
+        }
+
+        /// Compresses <text> into frames written after the last one, then
+        /// writes the index and trailer after them.
+        bool writeFrames(const string& text) {
+            fstream file(path, ios::in | ios::out | ios::binary);
+            if (!file.is_open()) return false;
+            file.seekp(dataEnd());
+
+            for (size_t done = 0; done < text.size();) {
+                size_t length = min(packedFrameSize, text.size() - done);
+                if (done + length < text.size()) {
+                    const size_t lineEnd = text.rfind('\n', done + length - 1);
+                    if (lineEnd != string::npos && lineEnd >= done) {
+                        length = lineEnd + 1 - done;
+                    }
+                }
+
+                const string packed = compressBlock(text.substr(done, length));
+                frames.push_back({dataEnd(), packed.size(), rawSize, length, lines + 1});
+                file.write(packed.data(), packed.size());
+                metrics.bytesWritten.fetch_add(packed.size(), memory_order_relaxed);
+
+                rawSize += length;
+                lines += count(text.begin() + done, text.begin() + done + length, '\n');
+                done += length;
+            }
+
+            ostringstream index;
+            index << rawSize << " " << lines << " " << frames.size() << "\n";
+            for (const auto& frame : frames) {
+                index << frame.offset << " " << frame.size << " " << frame.rawOffset
+                      << " " << frame.rawSize << " " << frame.firstLine << "\n";
+            }
+
+            char trailer[trailerSize + 1];
+            snprintf(trailer, sizeof(trailer), "%016llx CPPNZ1\n",
+                     static_cast<unsigned long long>(dataEnd()));
+            const string indexText = index.str();
+            file.write(indexText.data(), indexText.size());
+            file.write(trailer, trailerSize);
+            file.close();
+            if (!file) return false;
+
+            // Appends can shorten the file, since a short last frame is
+            // rewritten along with the new text.
+            error_code error;
+            fs::resize_file(path, dataEnd() + indexText.size() + trailerSize, error);
+            return !error;
+        }
+
+        /// Replaces the frames from <keep> on with <text>, refilling the
+        /// frame before them first if it is short. The note is copied to a
+        /// temporary file, rewritten there and renamed over the old one.
+        ///
+        /// Returns false, leaving the note as it was, if it can't.
+        bool rewriteFrom(size_t keep, const string& text) {
+            string pending;
+            if (keep > 0 && frames[keep - 1].rawSize < packedFrameSize) {
+                keep--;
+                if (!readFrame(keep, pending)) return false;
+            }
+
+            PackedNote staged = *this;
+            staged.path = path.string() + ".tmp";
+            if (keep < frames.size()) {
+                staged.rawSize = frames[keep].rawOffset;
+                staged.lines = frames[keep].firstLine - 1;
+                staged.frames.resize(keep);
+            }
+
+            error_code error;
+            fs::copy_file(path, staged.path, fs::copy_options::overwrite_existing, error);
+            if (error || !staged.writeFrames(pending + text)) {
+                fs::remove(staged.path, error);
+                return false;
+            }
+
+            syncFile(staged.path);
+            fs::rename(staged.path, path, error);
+            if (error) {
+                fs::remove(staged.path, error);
+                return false;
+            }
+
+            frames = move(staged.frames);
+            rawSize = staged.rawSize;
+            lines = staged.lines;
+            return true;
+        }
+
+    public:
+        static fs::path pathOf(const string& title) {
+            return saveDir / (title + packedExt);
+        }
+
+        static bool exists(const string& title) {
+            return fs::is_regular_file(pathOf(title));
+        }
+
+        uint64_t size() const { return rawSize; }
+        size_t frameCount() const { return frames.size(); }
+
+        /// Reads the frame index of packed note <title>.
+        bool load(const string& title) {
+            path = pathOf(title);
+            error_code error;
+            const uintmax_t fileSize = fs::file_size(path, error);
+            if (error || fileSize < magicSize + trailerSize) return false;
+
+            ifstream infile(path, ios::binary);
+            char trailer[trailerSize];
+            infile.seekg(fileSize - trailerSize);
+            infile.read(trailer, trailerSize);
+            if (!infile || memcmp(trailer + 16, " CPPNZ1\n", 8) != 0) return false;
+
+            const string indexText(trailer, 16);
+            char* end = nullptr;
+            const uint64_t indexOffset = strtoull(indexText.c_str(), &end, 16);
+            if (*end != '\0' || indexOffset < magicSize ||
+                indexOffset > fileSize - trailerSize) {
+                return false;
+            }
+
+            infile.seekg(indexOffset);
+            uint64_t count = 0;
+            if (!(infile >> rawSize >> lines >> count) ||
+                count > (fileSize - trailerSize - indexOffset) / minIndexLine) {
+                return false;
+            }
+
+            // The frames must follow each other from the magic line to the
+            // index, in the file and in the text, each no bigger than a
+            // frame can be.
+            frames.assign(count, PackedFrame());
+            uint64_t offset = magicSize;
+            uint64_t rawOffset = 0;
+            for (auto& frame : frames) {
+                if (!(infile >> frame.offset >> frame.size >> frame.rawOffset >>
+                      frame.rawSize >> frame.firstLine) ||
+                    frame.offset != offset || frame.size > maxFrameSize ||
+                    frame.size > indexOffset - offset || frame.rawOffset != rawOffset ||
+                    frame.rawSize > packedFrameSize || frame.firstLine == 0) {
+                    frames.clear();
+                    return false;
+                }
+                offset += frame.size;
+                rawOffset += frame.rawSize;
+            }
+
+            if (offset != indexOffset || rawOffset != rawSize) {
+                frames.clear();
+                return false;
+            }
+            return true;
+        }
+
+        /// Packs plain note <title> into frames and removes its plain file.
+        ///
+        /// Returns false, leaving the plain note alone, if it can't.
+        static bool pack(const string& title) {
+            const fs::path source = saveDir / (title + noteExt);
+            PackedNote note;
+            note.path = pathOf(title).string() + ".tmp";
+            ofstream(note.path, ios::binary) << magic;
+
+            ifstream infile(source, ios::binary);
+            string buffer(streamChunkSize, '\0');
+            string carry;
+
+            // Whole frames are written as the file streams in; the rest of
+            // each chunk waits for the next one.
+            error_code error;
+            while (infile.read(&buffer[0], buffer.size()) || infile.gcount() > 0) {
+                carry.append(buffer, 0, infile.gcount());
+                const size_t whole = carry.size() / packedFrameSize * packedFrameSize;
+                if (whole == 0) continue;
+
+                // A line longer than a frame is cut at the frame's end, so
+                // the carry never holds more than a chunk and a frame.
+                const size_t lineEnd = carry.rfind('\n', whole - 1);
+                const size_t cut = lineEnd == string::npos ? whole : lineEnd + 1;
+                if (!note.writeFrames(carry.substr(0, cut))) {
+                    fs::remove(note.path, error);
+                    return false;
+                }
+                carry.erase(0, cut);
+            }
+
+            if (!infile.eof() || !note.writeFrames(carry)) {
+                fs::remove(note.path, error);
+                return false;
+            }
+
+            fs::rename(note.path, pathOf(title), error);
+            if (error) {
+                fs::remove(note.path, error);
+                return false;
+            }
+            fs::remove(source, error);
+            return true;
+        }
+
+        /// Returns the note's head line.
+        string head() const {
+            if (frames.empty()) return "";
+            const string text = frameText(0);
+            return text.substr(0, text.find('\n'));
+        }
+
+        /// Returns <length> bytes of the note's text from <offset>.
+        string read(uint64_t offset, uint64_t length) const {
+            string result;
+
+            for (size_t i = frameAt(offset);
+                 i < frames.size() && frames[i].rawOffset < offset + length; ++i) {
+                const string text = frameText(i);
+                const uint64_t from = offset > frames[i].rawOffset
+                    ? offset - frames[i].rawOffset : 0;
+                if (from < text.size()) {
+                    result.append(text, from, offset + length - frames[i].rawOffset - from);
+                }
+            }
+
+            return result;
+        }
+
+        /// Returns up to <count> lines of the note starting at line <first>,
+        /// counting the head as line 1.
+        string readLines(uint64_t first, uint64_t count) const {
+            // Line <first> starts in the last frame that starts before it.
+            const auto after = lower_bound(
+                frames.begin(), frames.end(), first,
+                [](const PackedFrame& frame, uint64_t value) {
+                    return frame.firstLine < value;
+                });
+            size_t i = after == frames.begin() ? 0 : after - frames.begin() - 1;
+            string result;
+
+            for (uint64_t line = i < frames.size() ? frames[i].firstLine : 0;
+                 i < frames.size() && count > 0; ++i) {
+                const string text = frameText(i);
+                size_t pos = 0;
+
+                while (pos < text.size() && count > 0) {
+                    const size_t lineEnd = text.find('\n', pos);
+                    const size_t end = lineEnd == string::npos ? text.size() : lineEnd + 1;
+                    if (line >= first) result.append(text, pos, end - pos);
+                    pos = end;
+
+                    if (lineEnd != string::npos) {
+                        if (line >= first) count--;
+                        line++;
+                    }
+                }
+            }
+
+            return result;
+        }
+
+        /// Calls <consume> with each frame's offset and text, in order.
+        void forEachFrame(const function<void(uint64_t, const string&)>& consume) const {
+            for (size_t i = 0; i < frames.size(); ++i) {
+                consume(frames[i].rawOffset, frameText(i));
+            }
+        }
+
+        /// Appends <text>, refilling the last frame first if it is short.
+        bool append(const string& text) { return rewriteFrom(frames.size(), text); }
+
+        /// Cuts the note's text back to its first <size> bytes.
+        bool truncate(uint64_t size) {
+            if (size >= rawSize) return true;
+
+            const size_t keep = frameAt(size);
+            string partial;
+            if (!readFrame(keep, partial)) return false;
+            partial.resize(size - frames[keep].rawOffset);
+            return rewriteFrom(keep, partial);
+        }
+};
+
+/// Returns the file holding note <title>'s text: its packed file if it has
+/// been packed, otherwise its plain file.
+fs::path noteFile(const string& title) {
+    return PackedNote::exists(title) ? PackedNote::pathOf(title)
+                                     : saveDir / (title + noteExt);
+}
+
+/// Returns the directory holding the files attached to note <title>.
+fs::path attachmentsOf(const string& title) {
+    return saveDir / (title + attachmentExt);
+}
+
+/// Checks if a note called <title> exists in any form.
+bool noteExists(const string& title) {
+    return fs::exists(saveDir / (title + noteExt)) || LogNote::exists(title) ||
+           PackedNote::exists(title);
+}
+
+/// Streams the body of note <title> to <consume> a piece at a time, whether
+/// it is a plain, packed or log note.
+///
+/// Args:
+/// - 'title': The name of the note being read.
+/// - 'consume': Called with each piece of the note's body, in order.
+void streamNote(const string& title,
+                const function<void(const string&)>& consume) {
+    LogNote log;
+    PackedNote packed;
+    const auto counted = [&](const string& chunk) {
+        metrics.bytesRead.fetch_add(chunk.size(), memory_order_relaxed);
+        consume(chunk);
+    };
+
+    if (LogNote::exists(title) && log.load(title)) {
+        log.forEachSegment(counted);
+    } else if (PackedNote::exists(title) && packed.load(title)) {
+        packed.forEachFrame([&](uint64_t offset, const string& text) {
+            counted(offset == 0 ? noteBody(text) : text);
+        });
+    } else {
+        streamNoteBody(saveDir / (title + noteExt), counted);
+    }
+}
+
+/// Returns the head line of note <title>, whether plain, packed or log, or
+/// "" if it can't be read.
+string noteHead(const string& title) {
+    string head;
+    LogNote log;
+    PackedNote packed;
+
+    if (LogNote::exists(title) && log.load(title)) {
+        head = log.getHead();
+    } else if (PackedNote::exists(title) && packed.load(title)) {
+        head = packed.head();
+    } else {
+        ifstream infile(saveDir / (title + noteExt));
+        getline(infile, head);
+    }
+
+    return head;
+}
+
+/// Calls <consume> with each line of note <title>'s body, without its line
+/// end, whether the note is plain, packed or log.
+void forEachNoteLine(const string& title,
+                     const function<void(const string&)>& consume) {
+    string partial;
+
+    streamNote(title, [&](const string& chunk) {
+        size_t start = 0;
+        for (size_t end; (end = chunk.find('\n', start)) != string::npos; start = end + 1) {
+            partial.append(chunk, start, end - start);
+            consume(partial);
+            partial.clear();
+        }
+        partial.append(chunk, start, string::npos);
+    });
+
+    if (!partial.empty()) consume(partial);
+}
+
+/// Lists the files note <title> is saved in, whatever its form, as paths
+/// relative to the save directory. Outlines are left out; they are rebuilt
+/// from the note.
+vector<fs::path> noteFiles(const string& title) {
+    vector<fs::path> files;
+    error_code error;
+
+    if (LogNote::exists(title)) {
+        for (const auto& entry : fs::directory_iterator(LogNote::pathOf(title), error)) {
+            if (entry.is_regular_file()) {
+                files.push_back(fs::path(title + logExt) / entry.path().filename());
+            }
+        }
+        sort(files.begin(), files.end());
+    } else if (PackedNote::exists(title)) {
+        files.push_back(PackedNote::pathOf(title).filename());
+    } else if (fs::exists(saveDir / (title + noteExt), error)) {
+        files.push_back(title + noteExt);
+    }
+
+    return files;
+}
+
+/// Lists the files of every complete attachment of note <title>, as paths
+/// relative to the save directory, each attachment's manifest last.
+vector<fs::path> attachmentFiles(const string& title) {
+    vector<fs::path> files;
+    error_code error;
+
+    for (const auto& attachment : fs::directory_iterator(attachmentsOf(title), error)) {
+        const string name = attachment.path().filename().string();
+        if (!attachment.is_directory() || name[0] == '.') continue;
+
+        const fs::path dir = fs::path(title + attachmentExt) / name;
+        vector<fs::path> chunks;
+        for (const auto& chunk : fs::directory_iterator(attachment.path(), error)) {
+            const auto file = chunk.path().filename();
+            if (file != "manifest") chunks.push_back(dir / file);
+        }
+        files.insert(files.end(), chunks.begin(), chunks.end());
+        files.push_back(dir / "manifest");
+    }
+
+    return files;
+}
+
+/// Returns when note <title> was created, in minutes since the epoch, as
+/// written in its head line, or 0 if that can't be read.
+uint32_t noteCreated(const string& title) {
+    const string head = noteHead(title);
+    const size_t sep = head.find(headSep);
+    return sep == string::npos ? 0 : parseTimestamp(head.substr(sep + headSep.length()));
+}
+
+/// Checks if the directory entry <entry> is a saved note, plain, packed or
+/// log.
+bool isNoteEntry(const fs::directory_entry& entry) {
+    const auto extension = entry.path().extension();
+    return extension == noteExt || extension == packedExt ||
+           (extension == logExt && entry.is_directory());
+}
+
+/// What the catalog knows about one note.
+///
+/// Attributes:
+/// - 'title': The name of the note.
+/// - 'created': When the note was created, in minutes since the epoch.
+/// - 'size': The size of the note's file in bytes.
+/// - 'id': The note's number in 'noteIds'.
+struct CatalogEntry {
+    string title;
+    uint32_t created = 0;
+    uint64_t size = 0;
+    uint32_t id = 0;
+};
+
+/// Every saved note's title, creation time, size and number, laid out as a
+/// handful of flat arrays instead of one object per note.
+///
+/// Titles are sorted and front-coded in blocks of 'blockSize': the first
+/// title of a block is stored whole, and every other title as the length of
+/// the prefix it shares with the title before it plus the rest. A lookup
+/// binary searches the first titles of the blocks and then decodes a single
+/// block. The other fields live in packed arrays at the same positions.
+///
+/// Saves and deletes go into a small sorted overlay which is merged into
+/// the arrays once it holds 'maxPending' changes.
+///
+/// Attributes:
+/// - 'titleBlocks': The front-coded titles.
+/// - 'blockOffsets': Where each block starts in 'titleBlocks'.
+/// - 'created', 'sizes', 'ids': The other fields, by sorted position.
+/// - 'pending': Changes not yet merged; an empty value is a deletion.
+/// - 'noteCount': The number of notes in the catalog.
+/// - 'loaded': True once the save directory has been scanned.
+class Catalog {
+    private:
+        static constexpr size_t blockSize = 16;
+        static constexpr size_t maxPending = 1024;
+
+        vector<char> titleBlocks;
+        vector<uint32_t> blockOffsets;
+        vector<uint32_t> created;
+        vector<uint64_t> sizes;
+        vector<uint32_t> ids;
+        map<string, optional<CatalogEntry>> pending;
+        size_t noteCount = 0;
+        bool loaded = false;
+
+        /// Returns the first title of <block>.
+        string firstTitle(size_t block) const {
+            const char* pos = titleBlocks.data() + blockOffsets[block];
+            uint64_t length = 0;
+            readVarint(pos, titleBlocks.data() + titleBlocks.size(), length);
+            return string(pos, length);
+        }
+
+        /// Adds <entry> after every entry already in the arrays.
+        void appendEncoded(const CatalogEntry& entry, string& previous) {
+            if (ids.size() % blockSize == 0) {
+                blockOffsets.push_back(static_cast<uint32_t>(titleBlocks.size()));
+                appendVarint(titleBlocks, static_cast<uint32_t>(entry.title.size()));
+                titleBlocks.insert(titleBlocks.end(), entry.title.begin(),
+                                   entry.title.end());
+            } else {
+                size_t shared = 0;
+                while (shared < previous.size() && shared < entry.title.size() &&
+                       previous[shared] == entry.title[shared]) {
+                    shared++;
+                }
+                appendVarint(titleBlocks, static_cast<uint32_t>(shared));
+                appendVarint(titleBlocks,
+                             static_cast<uint32_t>(entry.title.size() - shared));
+                titleBlocks.insert(titleBlocks.end(), entry.title.begin() + shared,
+                                   entry.title.end());
+            }
+
+            created.push_back(entry.created);
+            sizes.push_back(entry.size);
+            ids.push_back(entry.id);
+            previous = entry.title;
+        }
+
+        /// Calls <visit> with the entries in the arrays, in order, starting
+        /// from the first title not less than <from>, until it returns false.
+        void forEachStored(const string& from,
+                           const function<bool(const CatalogEntry&)>& visit) const {
+            if (ids.empty()) return;
+
+            // Find the last block starting at or before <from>.
+            size_t low = 0;
+            size_t high = blockOffsets.size();
+            while (high - low > 1) {
+                const size_t mid = (low + high) / 2;
+                if (firstTitle(mid) <= from) low = mid; else high = mid;
+            }
+
+            const char* pos = titleBlocks.data() + blockOffsets[low];
+            const char* end = titleBlocks.data() + titleBlocks.size();
+            CatalogEntry entry;
+
+            for (size_t i = low * blockSize; i < ids.size(); ++i) {
+                if (i % blockSize == 0) {
+                    uint64_t length = 0;
+                    readVarint(pos, end, length);
+                    entry.title.assign(pos, length);
+                    pos += length;
+                } else {
+                    uint64_t shared = 0;
+                    uint64_t rest = 0;
+                    readVarint(pos, end, shared);
+                    readVarint(pos, end, rest);
+                    entry.title.resize(shared);
+                    entry.title.append(pos, rest);
+                    pos += rest;
+                }
+
+                if (entry.title < from) continue;
+
+                entry.created = created[i];
+                entry.size = sizes[i];
+                entry.id = ids[i];
+                if (!visit(entry)) return;
+            }
+        }
+
+        /// Merges the pending changes into the arrays.
+        void compact() {
+            Catalog merged;
+            string previous;
+
+            forEach("", [&](const CatalogEntry& entry) {
+                merged.appendEncoded(entry, previous);
+                return true;
+            });
+
+            titleBlocks = move(merged.titleBlocks);
+            blockOffsets = move(merged.blockOffsets);
+            created = move(merged.created);
+            sizes = move(merged.sizes);
+            ids = move(merged.ids);
+            titleBlocks.shrink_to_fit();
+            pending.clear();
+        }
+
+    public:
+        bool isLoaded() const { return loaded; }
+        void markLoaded() { loaded = true; }
+        bool hasPending() const { return !pending.empty(); }
+
+        /// Merges the pending changes into the arrays now, rather than when
+        /// there are 'maxPending' of them.
+        void merge() { if (!pending.empty()) compact(); }
+
+        /// Replaces the whole catalog with <entries>, in any order.
+        void build(vector<CatalogEntry> entries) {
+            clear();
+            sort(entries.begin(), entries.end(),
+                 [](const auto& a, const auto& b) { return a.title < b.title; });
+
+            string previous;
+            for (const auto& entry : entries) appendEncoded(entry, previous);
+            noteCount = entries.size();
+
+            titleBlocks.shrink_to_fit();
+            blockOffsets.shrink_to_fit();
+            created.shrink_to_fit();
+            sizes.shrink_to_fit();
+            ids.shrink_to_fit();
+            loaded = true;
+        }
+
+        /// Adds <entry>, or replaces the entry with the same title.
+        void put(const CatalogEntry& entry) {
+            if (!find(entry.title)) noteCount++;
+            pending[entry.title] = entry;
+            if (pending.size() >= maxPending) compact();
+        }
+
+        void remove(const string& title) {
+            if (find(title)) noteCount--;
+            pending[title] = nullopt;
+            if (pending.size() >= maxPending) compact();
+        }
+
+        /// Returns the entry for <title>, if there is one.
+        optional<CatalogEntry> find(const string& title) const {
+            const auto change = pending.find(title);
+            if (change != pending.end()) return change->second;
+
+            optional<CatalogEntry> found;
+            forEachStored(title, [&](const CatalogEntry& entry) {
+                if (entry.title == title) found = entry;
+                return false;
+            });
+
+            return found;
+        }
+
+        /// Calls <visit> with every entry in title order, starting from the
+        /// first title not less than <from>, until it returns false.
+        void forEach(const string& from,
+                     const function<bool(const CatalogEntry&)>& visit) const {
+            auto change = pending.lower_bound(from);
+            bool stopped = false;
+
+            // Emits the pending changes that sort up to <title>.
+            const auto flushBefore = [&](const string* title) {
+                for (; change != pending.end() &&
+                       (!title || change->first <= *title); ++change) {
+                    if (change->second && !visit(*change->second)) {
+                        stopped = true;
+                        return;
+                    }
+                }
+            };
+
+            forEachStored(from, [&](const CatalogEntry& entry) {
+                flushBefore(&entry.title);
+                if (stopped) return false;
+
+                // A pending change for the same title replaces this entry.
+                if (pending.count(entry.title)) return true;
+
+                if (!visit(entry)) {
+                    stopped = true;
+                    return false;
+                }
+                return true;
+            });
+
+            if (!stopped) flushBefore(nullptr);
+        }
+
+        /// Returns the number of notes in the catalog.
+        size_t count() const { return noteCount; }
+
+        size_t memoryUsage() const {
+            size_t bytes = titleBlocks.capacity() +
+                           blockOffsets.capacity() * sizeof(uint32_t) +
+                           created.capacity() * sizeof(uint32_t) +
+                           sizes.capacity() * sizeof(uint64_t) +
+                           ids.capacity() * sizeof(uint32_t);
+            for (const auto& [title, entry] : pending) {
+                bytes += 2 * title.capacity() + sizeof(CatalogEntry) + 64;
+            }
+            return bytes;
+        }
+
+        void clear() {
+            titleBlocks.clear();
+            titleBlocks.shrink_to_fit();
+            blockOffsets = {};
+            created = {};
+            sizes = {};
+            ids = {};
+            pending.clear();
+            noteCount = 0;
+            loaded = false;
+        }
+};
+
+Catalog catalog; // What is known about every saved note.
+
+/// The catalog published in a shared memory segment, so every CPPNotes
+/// process on the host working in the same save directory reads the one
+/// catalog instead of scanning the directory itself.
+///
+/// The segment holds a header and then one record per note: its creation
+/// time, size and title. Readers take no lock. They copy the records out
+/// under a seqlock: the sequence is odd while a writer is changing the
+/// segment, so a reader that saw an odd sequence, or a different one
+/// after copying, tries again. Writers are serialized by an flock on
+/// 'catalog.lock' in the save directory and always publish the whole
+/// catalog, after first picking up whatever was published since they
+/// last looked. The generation goes up on every publish so a process can
+/// tell, with one load, whether its own copy is still current.
+///
+/// Since writers hold the lock whenever the sequence is odd, a reader that
+/// finds it odd with the lock free knows the writer died part way through,
+/// and clears the segment so it is built again instead of waiting on it.
+///
+/// Publishing whole catalogs keeps readers simple but has a cost: each
+/// save or append rewrites every record under the lock, O(notes), and
+/// every other process drops its search indexes when it sees the new
+/// generation (see syncSharedCatalog). That is cheap for stores of a few
+/// thousand notes saved by hand, not for many processes writing at once.
+///
+/// Not available on Windows, where every method does nothing.
+///
+/// Attributes:
+/// - 'header': The start of the mapped segment, or null if not attached.
+/// - 'mapped': How many bytes of the segment are mapped.
+/// - 'seen': The generation this process last loaded or published.
+class SharedCatalog {
+    private:
+        static constexpr char magic[8] = "CPPNSC1";
+
+        struct Header {
+            char magic[8];
+            atomic<uint64_t> sequence;
+            atomic<uint64_t> generation;
+            atomic<uint64_t> capacity; // Bytes of records the segment can hold.
+            atomic<uint64_t> used; // Bytes of records published.
+            atomic<uint64_t> count; // Notes published.
+        };
+
+        int fd = -1;
+        int lockFd = -1;
+        bool locked = false;
+        Header* header = nullptr;
+        size_t mapped = 0;
+        uint64_t seen = 0;
+
+        char* records() const { return reinterpret_cast<char*>(header + 1); }
+
+        /// Maps the first <bytes> of the segment, replacing the old mapping.
+        bool map(size_t bytes) {
+#if !defined(_WIN32) && !defined(_WIN64)
+            void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (memory == MAP_FAILED) return false;
+            if (header) munmap(header, mapped);
+            header = static_cast<Header*>(memory);
+            mapped = bytes;
+            return true;
+#else
+            (void)bytes;
+            return false;
+#endif
+        }
+
+        /// Empties the segment, leaving the sequence even. The caller must
+        /// hold the writers' lock.
+        void clear() {
+            header->sequence.fetch_add(1, memory_order_acq_rel);
+            atomic_thread_fence(memory_order_release);
+            memset(header->magic, 0, sizeof(magic));
+            header->used.store(0, memory_order_relaxed);
+            header->count.store(0, memory_order_relaxed);
+            seen = header->generation.fetch_add(1, memory_order_relaxed) + 1;
+            header->sequence.fetch_add(1, memory_order_release);
+        }
+
+        /// Clears a segment left half written by a writer that died, which
+        /// is the case if its sequence is odd while the writers' lock is
+        /// free (or held by this process, which isn't writing).
+        ///
+        /// Returns false if a live writer holds the lock.
+        bool repairAbandoned() {
+#if !defined(_WIN32) && !defined(_WIN64)
+            const bool mine = locked;
+            if (!mine && (lockFd < 0 || flock(lockFd, LOCK_EX | LOCK_NB) != 0)) {
+                return false;
+            }
+
+            // Checked again under the lock: the writer may have just finished.
+            if (header->sequence.load(memory_order_acquire) & 1) {
+                header->sequence.fetch_add(1, memory_order_acq_rel);
+                clear();
+                logger.log(LogLevel::Warn, "shared_catalog_repaired", {});
+            }
+
+            if (!mine) flock(lockFd, LOCK_UN);
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        /// Maps the whole segment, if a writer has grown it since.
+        bool remap() {
+            const size_t wanted = sizeof(Header) + header->capacity.load(memory_order_acquire);
+            return wanted <= mapped || map(wanted);
+        }
+
+    public:
+        ~SharedCatalog() { detach(); }
+
+        /// Opens, or creates, the segment for the save directory <dir>.
+        ///
+        /// Returns false if shared memory can't be used.
+        bool attach(const fs::path& dir) {
+#if !defined(_WIN32) && !defined(_WIN64)
+            error_code error;
+            stringstream name;
+            name << "/cppnotes-" << hex << hash<string>{}(fs::absolute(dir, error).string());
+
+            fd = shm_open(name.str().c_str(), O_RDWR | O_CREAT, 0600);
+            lockFd = open((dir / "catalog.lock").c_str(), O_RDWR | O_CREAT, 0600);
+            if (fd < 0 || lockFd < 0) {
+                detach();
+                return false;
+            }
+
+            lock();
+            struct stat info;
+            const bool sized = fstat(fd, &info) == 0 &&
+                (static_cast<size_t>(info.st_size) >= sizeof(Header) ||
+                 ftruncate(fd, sizeof(Header)) == 0);
+            const bool ready = sized && map(sizeof(Header)) && remap();
+            unlock();
+
+            if (!ready) detach();
+            return ready;
+#else
+            (void)dir;
+            return false;
+#endif
+        }
+
+        void detach() {
+#if !defined(_WIN32) && !defined(_WIN64)
+            if (header) munmap(header, mapped);
+            if (fd >= 0) close(fd);
+            if (lockFd >= 0) close(lockFd);
+#endif
+            header = nullptr;
+            mapped = 0;
+            fd = lockFd = -1;
+        }
+
+        bool attached() const { return header != nullptr; }
+
+        /// Checks if nothing was published since this process last looked.
+        bool isCurrent() const {
+            return !header || header->generation.load(memory_order_acquire) == seen;
+        }
+
+        /// Returns how many notes the published catalog holds.
+        uint64_t count() const { return header ? header->count.load(memory_order_acquire) : 0; }
+
+        /// Takes the writers' lock, waiting for any other writer.
+        void lock() {
+#if !defined(_WIN32) && !defined(_WIN64)
+            if (lockFd >= 0) flock(lockFd, LOCK_EX);
+#endif
+            locked = true;
+        }
+
+        void unlock() {
+#if !defined(_WIN32) && !defined(_WIN64)
+            if (lockFd >= 0) flock(lockFd, LOCK_UN);
+#endif
+            locked = false;
+        }
+
+        /// Replaces <catalog> with the published one.
+        ///
+        /// Returns false, leaving <catalog> alone, if there is nothing
+        /// valid published, or a writer takes longer than
+        /// 'sharedCatalogWaitSeconds' to finish.
+        bool load(Catalog& catalog) {
+            if (!header) return false;
+
+            string copy;
+            uint64_t generation = 0;
+            bool valid = false;
+            const auto deadline = chrono::steady_clock::now() +
+                                  chrono::seconds(sharedCatalogWaitSeconds);
+
+            while (true) {
+                if (chrono::steady_clock::now() > deadline) return false;
+
+                const uint64_t before = header->sequence.load(memory_order_acquire);
+                if (before & 1) {
+                    if (!repairAbandoned()) this_thread::yield();
+                    continue;
+                }
+                if (!remap()) return false;
+
+                generation = header->generation.load(memory_order_relaxed);
+                const uint64_t used = header->used.load(memory_order_relaxed);
+                valid = memcmp(header->magic, magic, sizeof(magic)) == 0;
+                if (used > mapped - sizeof(Header)) continue;
+                copy.assign(records(), used);
+
+                atomic_thread_fence(memory_order_acquire);
+                if (header->sequence.load(memory_order_relaxed) == before) break;
+            }
+
+            seen = generation;
+            if (!valid) return false;
+
+            vector<CatalogEntry> entries;
+            for (size_t pos = 0; pos + 14 <= copy.size();) {
+                CatalogEntry entry;
+                uint16_t length;
+                memcpy(&entry.created, &copy[pos], 4);
+                memcpy(&entry.size, &copy[pos + 4], 8);
+                memcpy(&length, &copy[pos + 12], 2);
+                entry.title = copy.substr(pos + 14, length);
+                entry.id = noteIds.idFor(entry.title);
+                entries.push_back(move(entry));
+                pos += 14 + length;
+            }
+
+            catalog.build(move(entries));
+            return true;
+        }
+
+        /// Publishes <catalog> in place of what was there. The caller must
+        /// hold the writers' lock.
+        void publish(const Catalog& catalog) {
+            if (!header) return;
+
+            string bytes;
+            uint64_t count = 0;
+            catalog.forEach("", [&](const CatalogEntry& entry) {
+                const auto length = static_cast<uint16_t>(min<size_t>(entry.title.size(), UINT16_MAX));
+                bytes.append(reinterpret_cast<const char*>(&entry.created), 4);
+                bytes.append(reinterpret_cast<const char*>(&entry.size), 8);
+                bytes.append(reinterpret_cast<const char*>(&length), 2);
+                bytes.append(entry.title, 0, length);
+                count++;
+                return true;
+            });
+
+#if !defined(_WIN32) && !defined(_WIN64)
+            // Grow the segment first; readers map the new part when they
+            // see the bigger capacity.
+            if (bytes.size() > header->capacity.load(memory_order_relaxed)) {
+                const size_t capacity = max<size_t>(bytes.size() * 2, 64 << 10);
+                if (ftruncate(fd, sizeof(Header) + capacity) != 0 ||
+                    !map(sizeof(Header) + capacity)) {
+                    return;
+                }
+                header->capacity.store(capacity, memory_order_release);
+            }
+#endif
+
+            header->sequence.fetch_add(1, memory_order_acq_rel);
+            atomic_thread_fence(memory_order_release);
+            memcpy(header->magic, magic, sizeof(magic));
+            memcpy(records(), bytes.data(), bytes.size());
+            header->used.store(bytes.size(), memory_order_relaxed);
+            header->count.store(count, memory_order_relaxed);
+            seen = header->generation.fetch_add(1, memory_order_relaxed) + 1;
+            header->sequence.fetch_add(1, memory_order_release);
+        }
+
+        /// Marks the published catalog out of date, so the next process that
+        /// needs it scans the save directory and publishes it again.
+        void invalidate() {
+            if (!header) return;
+
+            const bool mine = locked;
+            if (!mine) lock();
+            clear();
+            if (!mine) unlock();
+        }
+};
+
+SharedCatalog sharedCatalog; // The catalog shared with other processes.
+
+/// Makes sure the catalog has been built. Only the head line of each note is
+/// read.
+void ensureCatalog() {
+    if (catalog.isLoaded()) return;
+
+    // Another process may have published it already.
+    if (sharedCatalog.load(catalog)) {
+        governor.set(Subsystem::Catalog, catalog.memoryUsage());
+        return;
+    }
+
+    vector<fs::path> files;
+
+    if (fs::is_directory(saveDir)) {
+        for (const auto& file : fs::directory_iterator(saveDir)) {
+            if (isNoteEntry(file)) files.push_back(file.path());
+        }
+    }
+
+    // Reading the heads is mostly waiting on the disk, so do it in parallel.
+    vector<CatalogEntry> entries(files.size());
+    runParallel(files.size(), [&](size_t i) {
+        const auto extension = files[i].extension();
+        const string title = files[i].stem().string();
+        string head;
+        LogNote log;
+        PackedNote packed;
+
+        entries[i].title = title;
+        if (extension == logExt && log.load(title)) {
+            head = log.getHead();
+            entries[i].size = log.size();
+        } else if (extension == packedExt && packed.load(title)) {
+            head = packed.head();
+            entries[i].size = packed.size();
+        } else if (extension == noteExt) {
+            ifstream infile(files[i]);
+            getline(infile, head);
+            error_code error;
+            entries[i].size = fs::file_size(files[i], error);
+        }
+
+        const size_t sep = head.find(headSep);
+        if (sep != string::npos) {
+            entries[i].created = parseTimestamp(head.substr(sep + headSep.length()));
+        }
+    });
+
+    for (auto& entry : entries) entry.id = noteIds.idFor(entry.title);
+
+    // Publish the scan, unless another process published first.
+    sharedCatalog.lock();
+    if (sharedCatalog.isCurrent() || !sharedCatalog.load(catalog)) {
+        catalog.build(move(entries));
+        sharedCatalog.publish(catalog);
+    }
+    sharedCatalog.unlock();
+    governor.set(Subsystem::Catalog, catalog.memoryUsage());
+}
+
+/// Applies <change> to the catalog and publishes the result to the other
+/// processes. Whatever they published since is picked up first, so no
+/// change is lost. Nothing is done if there is no catalog to change, loaded
+/// here or published.
+///
+/// Returns false if <change> wasn't applied.
+bool changeCatalog(const function<void()>& change) {
+    sharedCatalog.lock();
+
+    if ((!sharedCatalog.isCurrent() || !catalog.isLoaded()) &&
+        !sharedCatalog.load(catalog) && !catalog.isLoaded()) {
+        sharedCatalog.unlock();
+        return false;
+    }
+
+    change();
+    sharedCatalog.publish(catalog);
+    sharedCatalog.unlock();
+    governor.set(Subsystem::Catalog, catalog.memoryUsage());
+    return true;
+}
+
+/// Records how much memory the search indexes hold with the governor.
+void chargeSearchIndexes() {
+    governor.set(Subsystem::SearchIndex, vocabulary.memoryUsage() +
+                                         tagIndex.memoryUsage() +
+                                         wordIndex.memoryUsage() +
+                                         similarity.memoryUsage() +
+                                         titleTrie.memoryUsage());
+}
+
+/// Makes sure the title trie has been built. Only the names of the saved
+/// notes are read, not their contents.
+void ensureTitleIndex() {
+    if (titleTrie.isLoaded()) return;
+
+    if (fs::is_directory(saveDir)) {
+        for (const auto& entry : fs::directory_iterator(saveDir)) {
+            if (isNoteEntry(entry)) {
+                titleTrie.insert(entry.path().stem().string());
+            }
+        }
+    }
+
+    titleTrie.markLoaded();
+    chargeSearchIndexes();
+}
+
+/// Prints the saved titles closest to <title>, if there are any, for when
+/// <title> itself does not exist.
+///
+/// Args:
+/// - 'title': The title the user typed.
+void suggestTitles(const string& title) {
+    ensureTitleIndex();
+    const auto titles = titleTrie.closest(title, maxTypoDistance,
+                                          maxSuggestions);
+    if (titles.empty()) return;
+
+    cout << "Did you mean:";
+    for (const auto& suggestion : titles) cout << " '" << suggestion << "'";
+    cout << "?\n";
+}
+
+/// Makes sure the indexes over the saved notes have been built, scanning the
+/// save directory the first time they are needed.
+void ensureIndexes() {
+    if (vocabulary.isLoaded()) return;
+
+    if (fs::is_directory(saveDir)) {
+        for (const auto& entry : fs::directory_iterator(saveDir)) {
+            if (!isNoteEntry(entry)) continue;
+
+            const string title = entry.path().stem().string();
+            set<string> tags;
+            set<string> terms;
+            unordered_map<string, int> counts;
+            vocabulary.removeNote(title);
+            streamNote(title, [&](const string& chunk) {
+                vocabulary.appendToNote(title, chunk);
+                const set<string> chunkTags = extractTags(chunk);
+                tags.insert(chunkTags.begin(), chunkTags.end());
+                for (const auto& [term, count] : countTerms(chunk)) {
+                    terms.insert(term);
+                    counts[term] += count;
+                }
+            });
+            tagIndex.setKeys(noteIds.idFor(title), tags);
+            wordIndex.setKeys(noteIds.idFor(title), terms);
+            similarity.setNote(noteIds.idFor(title), counts);
+        }
+    }
+
+    vocabulary.markLoaded();
+    chargeSearchIndexes();
+}
+
+/// Counters that go up whenever what they cover changes, so cached results
+/// can tell whether they are still current.
+///
+/// Attributes:
+/// - 'store': Goes up on every save and delete.
+/// - 'titles': Goes up when a note is created or deleted.
+/// - 'tags': Goes up when the tags of any note change.
+/// - 'words': Goes up when the set of words in any note changes.
+/// - 'bodies': Goes up when the body of any note changes.
+struct StoreGenerations {
+    uint64_t store = 0;
+    uint64_t titles = 0;
+    uint64_t tags = 0;
+    uint64_t words = 0;
+    uint64_t bodies = 0;
+};
+
+StoreGenerations generations; // Current generations of the note store.
+
+/// Updates the indexes after a note has been saved.
+///
+/// Args:
+/// - 'note': The note that was just saved.
+void indexNote(const Note& note) {
+    // Without an index to compare against, assume everything changed.
+    bool newTitle = true;
+    bool newTags = true;
+    bool newWords = true;
+
+    CatalogEntry entry;
+    entry.title = note.getName();
+    entry.created = parseTimestamp(note.getTimestamp());
+    entry.size = note.getContent().size();
+    entry.id = noteIds.idFor(note.getName());
+    changeCatalog([&] {
+        newTitle = !catalog.find(note.getName());
+        catalog.put(entry);
+    });
+
+    if (titleTrie.isLoaded()) {
+        titleTrie.insert(note.getName());
+        chargeSearchIndexes();
+    }
+
+    if (vocabulary.isLoaded()) {
+        const string body = noteBody(note.getContent());
+        vocabulary.addNote(note.getName(), body);
+        newTags = tagIndex.setKeys(noteIds.idFor(note.getName()),
+                                   extractTags(body));
+        newWords = wordIndex.setKeys(noteIds.idFor(note.getName()),
+                                     extractTerms(body));
+        similarity.setNote(noteIds.idFor(note.getName()), countTerms(body));
+        chargeSearchIndexes();
+    }
+
+    generations.store++;
+    generations.bodies++;
+    generations.titles += newTitle;
+    generations.tags += newTags;
+    generations.words += newWords;
+}
+
+/// Updates the indexes after lines were appended to the end of a note
+/// without the rest of it being loaded.
+///
+/// Args:
+/// - 'title': The name of the note that was appended to.
+/// - 'text': The lines that were appended.
+void indexAppend(const string& title, const string& text) {
+    bool newTags = true;
+    bool newWords = true;
+
+    changeCatalog([&] {
+        if (auto entry = catalog.find(title)) {
+            entry->size += text.size();
+            catalog.put(*entry);
+        }
+    });
+
+    if (vocabulary.isLoaded()) {
+        vocabulary.appendToNote(title, text);
+        newTags = tagIndex.addKeys(noteIds.idFor(title), extractTags(text));
+        newWords = wordIndex.addKeys(noteIds.idFor(title), extractTerms(text));
+        similarity.addToNote(noteIds.idFor(title), countTerms(text));
+        chargeSearchIndexes();
+    }
+
+    generations.store++;
+    generations.bodies++;
+    generations.tags += newTags;
+    generations.words += newWords;
+}
+
+/// Updates the indexes after notes have been deleted.
+///
+/// Args:
+/// - 'titles': The names of the notes that were deleted.
+void unindexNotes(const vector<string>& titles) {
+    uint32_t id;
+
+    changeCatalog([&] {
+        for (const auto& title : titles) catalog.remove(title);
+    });
+
+    for (const auto& title : titles) {
+        vocabulary.removeNote(title);
+        titleTrie.remove(title);
+        if (noteIds.find(title, id)) {
+            tagIndex.setKeys(id, {});
+            wordIndex.setKeys(id, {});
+            similarity.removeNote(id);
+        }
+    }
+    chargeSearchIndexes();
+
+    generations.store++;
+    generations.titles++;
+    generations.tags++;
+    generations.words++;
+    generations.bodies++;
+}
+
+/// Drops every index and cached result this process built from the saved
+/// notes. Everything is rebuilt on next use.
+void dropIndexes() {
+    catalog.clear();
+    vocabulary.clear();
+    tagIndex.clear();
+    wordIndex.clear();
+    similarity.clear();
+    titleTrie.clear();
+    chargeSearchIndexes();
+    governor.set(Subsystem::Catalog, 0);
+
+    generations.store++;
+    generations.titles++;
+    generations.tags++;
+    generations.words++;
+    generations.bodies++;
+}
+
+/// Drops every index and cached result after notes were changed behind
+/// their back, e.g. by an import, here and in every other process.
+void reloadIndexes() {
+    dropIndexes();
+    sharedCatalog.invalidate();
+}
+
+/// Catches up with notes saved or deleted by another CPPNotes process since
+/// this one last looked. What was built here from the old notes is dropped
+/// and the catalog is read back from the shared one, without a scan.
+void syncSharedCatalog() {
+    if (sharedCatalog.isCurrent()) return;
+
+    dropIndexes();
+    if (sharedCatalog.load(catalog)) {
+        governor.set(Subsystem::Catalog, catalog.memoryUsage());
+    }
+}
+
+/// Attaches to the shared catalog of the save directory. A catalog left
+/// from before notes were added or removed by something other than
+/// CPPNotes is marked out of date; only the directory is listed to check.
+void attachSharedCatalog() {
+    if (!sharedCatalog.attach(saveDir)) return;
+
+    uint64_t notes = 0;
+    error_code error;
+    for (fs::directory_iterator it(saveDir, error), end; !error && it != end;
+         it.increment(error)) {
+        notes += isNoteEntry(*it);
+    }
+
+    Catalog published;
+    if (sharedCatalog.load(published) && published.count() != notes) {
+        sharedCatalog.invalidate();
+    }
+}
+
+/// A heading in a note's outline.
+///
+/// Attributes:
+/// - 'level': The number of '#' the heading starts with.
+/// - 'offset': Where the heading's line starts in the note's file.
+/// - 'heading': The heading's text.
+struct OutlineEntry {
+    unsigned level;
+    uint64_t offset;
+    string heading;
+};
+
+/// The '#'-style headings of a note and where they are in its file, so a
+/// section can be read by seeking straight to it.
+///
+/// An outline is saved next to its note and records the size and write
+/// time of the note's file when it was made. If the note was changed some
+/// other way the outline is stale and gets rebuilt on its next use.
+/// Appending to a note only scans the appended text.
+///
+/// Attributes:
+/// - 'entries': The headings, in file order.
+/// - 'scanned': The size of the note's file the outline covers.
+/// - 'modified': The write time of the note's file the outline covers.
+/// - 'inFence': True if the scanned text ends inside a ``` code block,
+///   where lines starting with '#' are comments, not headings.
+class Outline {
+    public:
+        vector<OutlineEntry> entries;
+        uint64_t scanned = 0;
+        long long modified = 0;
+        bool inFence = false;
+
+        static fs::path pathOf(const string& title) {
+            return saveDir / (title + outlineExt);
+        }
+
+        /// Adds the headings read from <in>, whose text starts at <offset>
+        /// in the note's file.
+        void scan(istream& in, uint64_t offset) {
+            string line;
+
+            while (getline(in, line)) {
+                const uint64_t lineStart = offset;
+                offset += line.length() + 1;
+
+                if (line.compare(0, 3, "```") == 0) {
+                    inFence = !inFence;
+                    continue;
+                }
+
+                const size_t level = line.find_first_not_of('#');
+                if (inFence || level == 0 || level > 6 || level == string::npos ||
+                    line[level] != ' ') {
+                    continue;
+                }
+
+                const size_t text = line.find_first_not_of(' ', level);
+                if (text == string::npos) continue;
+                entries.push_back({static_cast<unsigned>(level), lineStart,
+                                   line.substr(text)});
+            }
+        }
+
+        /// Checks if the outline covers the current file at <filePath>.
+        bool matches(const fs::path& filePath) const {
+            error_code error;
+            const uintmax_t size = fs::file_size(filePath, error);
+            const auto time = fs::last_write_time(filePath, error);
+            return !error && size == scanned &&
+                   time.time_since_epoch().count() == modified;
+        }
+
+        /// Records that the outline now covers the file at <filePath>.
+        void stamp(const fs::path& filePath) {
+            error_code error;
+            scanned = fs::file_size(filePath, error);
+            modified = fs::last_write_time(filePath, error)
+                           .time_since_epoch().count();
+        }
+
+        bool load(const string& title) {
+            ifstream infile(pathOf(title));
+            if (!(infile >> scanned >> modified >> inFence)) return false;
+
+            entries.clear();
+            OutlineEntry entry;
+            while (infile >> entry.level >> entry.offset) {
+                infile.get();
+                getline(infile, entry.heading);
+                entries.push_back(entry);
+            }
+
+            return true;
+        }
+
+        bool save(const string& title) const {
+            const fs::path tempPath = pathOf(title).string() + ".tmp";
+            ofstream outfile(tempPath);
+            outfile << scanned << " " << modified << " " << inFence << "\n";
+
+            for (const auto& entry : entries) {
+                outfile << entry.level << " " << entry.offset << " "
+                        << entry.heading << "\n";
+            }
+
+            outfile.close();
+            error_code error;
+            if (outfile) fs::rename(tempPath, pathOf(title), error);
+            return outfile && !error;
+        }
+};
+
+/// Rebuilds the outline of note <title> from its saved content <content>.
+void writeOutline(const string& title, const string& content) {
+    Outline outline;
+    istringstream in(content);
+    outline.scan(in, 0);
+    outline.stamp(saveDir / (title + noteExt));
+    outline.save(title);
+}
+
+/// Adds the headings in <text>, just appended to note <title> whose file
+/// was <oldSize> bytes before, to the note's outline.
+void extendOutline(const string& title, uint64_t oldSize, const string& text) {
+    Outline outline;
+
+    // Without an outline that ends where the append began, the next use
+    // rebuilds it from the whole file.
+    if (!outline.load(title) || outline.scanned != oldSize) return;
+
+    istringstream in(text);
+    outline.scan(in, oldSize);
+    outline.stamp(saveDir / (title + noteExt));
+    outline.save(title);
+}
+
+/// Returns the outline of note <title>, rebuilding it from the note's file
+/// if it is missing or stale.
+Outline ensureOutline(const string& title) {
+    const auto filePath = noteFile(title);
+    Outline outline;
+    if (outline.load(title) && outline.matches(filePath)) return outline;
+
+    outline = Outline();
+    PackedNote packed;
+
+    if (filePath.extension() == packedExt && packed.load(title)) {
+        packed.forEachFrame([&](uint64_t offset, const string& text) {
+            istringstream in(text);
+            outline.scan(in, offset);
+        });
+    } else {
+        ifstream infile(filePath, ios::binary);
+        outline.scan(infile, 0);
+    }
+
+    outline.stamp(filePath);
+    outline.save(title);
+    return outline;
+}
+
+/// Saves a given note to the current directory.
+///
+/// Returns false if the note couldn't be written.
+///
+/// Args:
+/// - 'note': The note that is being saved.
+/// - 'quiet': Whether to leave reporting the result to the caller, as the
+///   editor does for '!save'.
+bool saveNote(const Note& note, bool quiet = false) {
+    const auto filePath = saveDir / (note.getName() + noteExt);
+    ofstream outfile(filePath);
+
+    if (outfile.is_open()) {
+        outfile << note.getContent();
+        outfile.close();
+        syncFile(filePath);
+        metrics.bytesWritten.fetch_add(note.getContent().size(),
+                                       memory_order_relaxed);
+        writeOutline(note.getName(), note.getContent());
+        indexNote(note);
+        logger.log(LogLevel::Info, "note_saved", {
+            {"note", note.getName()},
+            {"bytes", to_string(note.getContent().size())}});
+        if (!quiet) cout << note.getName() << " successfully saved!\n\n";
+        return true;
+    } else {
+        logger.log(LogLevel::Error, "save_failed", {
+            {"note", note.getName()}, {"path", filePath.string()},
+            {"error", strerror(errno)}});
+        if (!quiet) cout << "ERROR: " << note.getName() << " failed to save.\n\n";
+        return false;
+    }
+}
+
+/// The lines typed into the editor during one session, with undo and redo.
+///
+/// Typed text only ever goes onto the end of 'buffer'. The note's new text
+/// is the ranges of 'buffer' listed in 'applied', in order. Undo moves the
+/// last range over to 'undone' and redo moves it back, so each operation
+/// costs two offsets however long the line or the note is. Typing after an
+/// undo drops the ranges that could have been redone.
+///
+/// Attributes:
+/// - 'buffer': Every line typed this session, undone ones included.
+/// - 'applied': The (offset, length) ranges of 'buffer' in the note.
+/// - 'undone': Ranges taken back by undo, most recent last.
+class EditLog {
+    private:
+        string buffer;
+        vector<pair<size_t, size_t>> applied;
+        vector<pair<size_t, size_t>> undone;
+
+        /// Prints the text of <range>, straight from the buffer.
+        void print(const string& label, pair<size_t, size_t> range) const {
+            cout << "(" << label << ": ";
+            cout.write(buffer.data() + range.first,
+                       range.second > 0 ? range.second - 1 : 0);
+            cout << ")\n";
+        }
+
+    public:
+        void add(const string& line) {
+            applied.emplace_back(buffer.size(), line.size() + 1);
+            buffer += line;
+            buffer += '\n';
+            undone.clear();
+        }
+
+        /// Takes back the last line. Returns false if there is none.
+        bool undo() {
+            if (applied.empty()) return false;
+            undone.push_back(applied.back());
+            applied.pop_back();
+            print("undone", undone.back());
+            return true;
+        }
+
+        /// Puts back the last line taken back. Returns false if there is none.
+        bool redo() {
+            if (undone.empty()) return false;
+            applied.push_back(undone.back());
+            undone.pop_back();
+            print("redone", applied.back());
+            return true;
+        }
+
+        /// Returns the text the note currently gains from this session.
+        string text() const {
+            string result;
+            for (const auto& [offset, length] : applied) {
+                result.append(buffer, offset, length);
+            }
+            return result;
+        }
+
+        size_t memoryUsage() const {
+            return buffer.capacity() +
+                   (applied.capacity() + undone.capacity()) *
+                   sizeof(pair<size_t, size_t>);
+        }
+};
+
+/// Reads the lines the user types into the editor until they type !quit,
+/// handling editor commands along the way.
+///
+/// Returns the newly typed lines, without any that were undone.
+///
+/// Args:
+/// - 'loadedBytes': Bytes of the note already held in memory by the editor.
+/// - 'save': Saves the note with the given new lines, for '!save'.
+string readEditorInput(size_t loadedBytes,
+                       const function<void(const string&)>& save) {
+    string line;
+    EditLog edits;
+
+    governor.set(Subsystem::EditorBuffers, loadedBytes);
+
+    while (true) {
+        getline(cin, line);
+        if (line == "!quit") break;
+
+        if (line.compare(0, 10, "!complete ") == 0) {
+            ensureIndexes();
+            const auto words = vocabulary.complete(extractArg(line),
+                                                   maxCompletions);
+            cout << (words.empty() ? "(no completions)" : ">");
+            for (const auto& word : words) cout << " " << word;
+            cout << "\n";
+            continue;
+        }
+
+        if (line == "!undo") {
+            if (!edits.undo()) cout << "(nothing to undo)\n";
+            continue;
+        }
+
+        if (line == "!redo") {
+            if (!edits.redo()) cout << "(nothing to redo)\n";
+            continue;
+        }
+
+        if (line == "!save") {
+            save(edits.text());
+            continue;
+        }
+
+        edits.add(line);
+        governor.set(Subsystem::EditorBuffers,
+                     loadedBytes + edits.memoryUsage());
+    }
+
+    return edits.text();
+}
+
+/// Prints the editor's header for <note>.
+///
+/// Args:
+/// - 'note': The note that is being opened.
+void printEditorHeader(const Note& note) {
+    system(clearScreen);
+    cout << "" << note.getName() << headSep << note.getTimestamp() << "\n";
+    cout << "Type !quit on a new line to exit. Also: !undo, !redo, !save, "
+            "!complete [prefix].\n\n";
+}
+
+/// Handles the editing of a note.
+///
+/// Args:
+/// - 'note': The note that is being opened.
+void openNote(Note& note) {
+    const size_t startUserContent = note.getContent().find("\n\n");
+    const string userContent = note.getContent().substr(startUserContent + 2);
+    const string head = note.getName() + headSep + note.getTimestamp() + "\n\n";
+
+    printEditorHeader(note);
+    cout << userContent;
+
+    const string newContent = readEditorInput(
+        note.getContent().capacity() + userContent.capacity(),
+        [&](const string& text) {
+            note.setContent(head + userContent + text);
+            cout << (saveNote(note, true) ? "(saved)\n" : "(failed to save)\n");
+        });
+
+    note.setContent(head + userContent + newContent);
+    saveNote(note);
+    governor.set(Subsystem::EditorBuffers, 0);
+}
+
+/// Handles appending to a note too large to load into memory. Only the end
+/// of the note is shown, and the new lines are written straight onto the
+/// end of its file.
+///
+/// Args:
+/// - 'note': The note that is being opened, holding only its head.
+/// - 'filePath': The path of the note's file.
+void openLargeNote(const Note& note, const fs::path& filePath) {
+    const uintmax_t size = fs::file_size(filePath);
+    ifstream infile(filePath, ios::binary);
+    string window(min<uintmax_t>(size, tailWindowSize), '\0');
+
+    infile.seekg(size - window.size());
+    infile.read(&window[0], window.size());
+    infile.close();
+
+    // Start the window on a whole line.
+    const size_t firstLine = window.find('\n');
+    if (window.size() < size && firstLine != string::npos) {
+        window.erase(0, firstLine + 1);
+    }
+
+    printEditorHeader(note);
+    cout << "... (" << (size - window.size()) / 1024 << " KB above not "
+            "shown)\n";
+    cout << window;
+
+    // Cuts the file back to its size before this session, so lines undone
+    // after a '!save' go away, and writes the current new lines.
+    const auto writeNewLines = [&](const string& newContent) {
+        error_code error;
+        fs::resize_file(filePath, size, error);
+        ofstream outfile(filePath, ios::app | ios::binary);
+        if (error || !outfile.is_open()) return false;
+
+        outfile << newContent;
+        metrics.bytesWritten.fetch_add(newContent.size(), memory_order_relaxed);
+        return static_cast<bool>(outfile);
+    };
+
+    const string newContent = readEditorInput(
+        window.capacity(), [&](const string& text) {
+            cout << (writeNewLines(text) ? "(saved)\n" : "(failed to save)\n");
+        });
+
+    if (writeNewLines(newContent)) {
+        syncFile(filePath);
+        extendOutline(note.getName(), size, newContent);
+        indexAppend(note.getName(), newContent);
+        logger.log(LogLevel::Info, "note_appended", {
+            {"note", note.getName()}, {"bytes", to_string(newContent.size())}});
+        cout << note.getName() << " successfully saved!\n\n";
+    } else {
+        logger.log(LogLevel::Error, "append_failed", {
+            {"note", note.getName()}, {"path", filePath.string()},
+            {"error", strerror(errno)}});
+        cout << "ERROR: " << note.getName() << " failed to save.\n\n";
+    }
+
+    governor.set(Subsystem::EditorBuffers, 0);
+}
+
+/// Handles appending to a packed note. Only the frames holding the end of
+/// the note are decompressed to show it, and new lines only rewrite the
+/// last frame and the frame index.
+///
+/// Args:
+/// - 'title': The name of the packed note.
+void openPackedNote(const string& title) {
+    PackedNote packed;
+
+    if (!packed.load(title)) {
+        logger.log(LogLevel::Error, "packed_note_load_failed", {
+            {"note", title}, {"path", PackedNote::pathOf(title).string()}});
+        cout << "ERROR: '" << title << "' failed to load.\n\n";
+        return;
+    }
+
+    const string head = packed.head();
+    const size_t sep = head.find(headSep);
+    const Note note(title, sep == string::npos ? "" : head.substr(sep + headSep.length()),
+                    head + "\n\n");
+    const uint64_t size = packed.size();
+    const uint64_t length = min<uint64_t>(size, tailWindowSize);
+    string window = packed.read(size - length, length);
+
+    // Start the window on a whole line.
+    const size_t firstLine = window.find('\n');
+    if (window.size() < size && firstLine != string::npos) {
+        window.erase(0, firstLine + 1);
+    }
+
+    printEditorHeader(note);
+    cout << "... (" << (size - window.size()) / 1024 << " KB above not "
+            "shown)\n";
+    cout << window;
+
+    // Cuts the note back to its size before this session, so lines undone
+    // after a '!save' go away, and appends the current new lines.
+    const auto writeNewLines = [&](const string& newContent) {
+        return packed.truncate(size) && packed.append(newContent);
+    };
+
+    const string newContent = readEditorInput(
+        window.capacity(), [&](const string& text) {
+            cout << (writeNewLines(text) ? "(saved)\n" : "(failed to save)\n");
+        });
+
+    if (writeNewLines(newContent)) {
+        syncFile(PackedNote::pathOf(title));
+        indexAppend(title, newContent);
+        logger.log(LogLevel::Info, "note_appended", {
+            {"note", title}, {"bytes", to_string(newContent.size())},
+            {"frames", to_string(packed.frameCount())}});
+        cout << title << " successfully saved!\n\n";
+    } else {
+        logger.log(LogLevel::Error, "append_failed", {
+            {"note", title}, {"path", PackedNote::pathOf(title).string()},
+            {"error", strerror(errno)}});
+        cout << "ERROR: " << title << " failed to save.\n\n";
+    }
+
+    governor.set(Subsystem::EditorBuffers, 0);
+}
+
+/// Handles the editing of a log note. Only the end of the log is shown,
+/// and new lines go onto its tail segment.
+///
+/// Args:
+/// - 'title': The name of the log note.
+/// - 'appendMode': True if user is appending, false if user is overwriting.
+void openLogNote(const string& title, const bool& appendMode) {
+    LogNote log;
+
+    if (!log.load(title) || (!appendMode && !log.reset())) {
+        logger.log(LogLevel::Error, "log_note_load_failed", {
+            {"note", title}, {"path", LogNote::pathOf(title).string()},
+            {"error", strerror(errno)}});
+        cout << "ERROR: '" << title << "' failed to load.\n\n";
+        return;
+    }
+
+    const string& head = log.getHead();
+    const size_t sep = head.find(headSep);
+    const Note note(title, sep == string::npos ? "" : head.substr(sep + headSep.length()),
+                    head + "\n\n");
+    string window = log.readTail(tailWindowSize);
+    const uint64_t size = log.size();
+
+    // Start the window on a whole line.
+    const size_t firstLine = window.find('\n');
+    if (window.size() < size && firstLine != string::npos) {
+        window.erase(0, firstLine + 1);
+    }
+
+    printEditorHeader(note);
+    if (window.size() < size) {
+        cout << "... (" << (size - window.size()) / 1024 << " KB in "
+             << log.segmentCount() << " segments above not shown)\n";
+    }
+    cout << window;
+
+    // Cuts the log back to where it ended before this session, so lines
+    // undone after a '!save' go away, and appends the current new lines.
+    const auto start = log.snapshot();
+    const auto writeNewLines = [&](const string& newContent) {
+        return log.restore(start) && log.append(newContent);
+    };
+
+    const string newContent = readEditorInput(
+        window.capacity(), [&](const string& text) {
+            cout << (writeNewLines(text) ? "(saved)\n" : "(failed to save)\n");
+        });
+
+    if (writeNewLines(newContent)) {
+        if (appendMode) {
+            indexAppend(title, newContent);
+        } else {
+            indexNote(Note(title, note.getTimestamp(), head + "\n\n" + newContent));
+        }
+        logger.log(LogLevel::Info, "note_appended", {
+            {"note", title}, {"bytes", to_string(newContent.size())},
+            {"segments", to_string(log.segmentCount())}});
+        cout << title << " successfully saved!\n\n";
+    } else {
+        logger.log(LogLevel::Error, "append_failed", {
+            {"note", title}, {"path", LogNote::pathOf(title).string()},
+            {"error", strerror(errno)}});
+        cout << "ERROR: " << title << " failed to save.\n\n";
+    }
+
+    governor.set(Subsystem::EditorBuffers, 0);
+}
+
+/// Creates a new log note and opens it.
+///
+/// Args:
+/// - 'title': The given name of the new log note.
+void createLogNote(const string& title) {
+    if (noteExists(title)) {
+        cout << "ERROR: '" << title << "' already exists.\n\n";
+        return;
+    }
+
+    const Note note(title, getCurrentTime(), "");
+    const string head = note.getName() + headSep + note.getTimestamp();
+    LogNote log;
+
+    if (!log.create(title, head)) {
+        logger.log(LogLevel::Error, "log_note_create_failed", {
+            {"note", title}, {"error", strerror(errno)}});
+        cout << "ERROR: '" << title << "' could not be created.\n\n";
+        return;
+    }
+
+    indexNote(Note(title, note.getTimestamp(), head + "\n\n"));
+    openLogNote(title, true);
+}
+
+/// Prints the end of note <title>: the last segment of a log note, or the
+/// last 'tailWindowSize' bytes of a plain note.
+///
+/// Args:
+/// - 'title': The name of the note.
+void tailNote(const string& title) {
+    const auto filePath = saveDir / (title + noteExt);
+    LogNote log;
+    PackedNote packed;
+    string window;
+
+    if (LogNote::exists(title) && log.load(title)) {
+        window = log.readTail(logSegmentSize);
+    } else if (PackedNote::exists(title) && packed.load(title)) {
+        // Only the frames holding the last 'tailWindowSize' bytes are read.
+        const uint64_t length = min<uint64_t>(packed.size(), tailWindowSize);
+        window = packed.read(packed.size() - length, length);
+        const size_t firstLine = window.find('\n');
+        if (firstLine != string::npos) window.erase(0, firstLine + 1);
+    } else if (fs::exists(filePath)) {
+        // Only the body is shown, so skip the head of a short note.
+        streamNoteBody(filePath, [&](const string& chunk) {
+            window += chunk;
+            if (window.size() > tailWindowSize) {
+                window.erase(0, window.size() - tailWindowSize);
+            }
+        });
+    } else {
+        cout << "ERROR: '" << title << "' does not exist.\n";
+        suggestTitles(title);
+        cout << "\n";
+        return;
+    }
+
+    cout << window << (window.empty() || window.back() == '\n' ? "" : "\n")
+         << "\n";
+}
+
+/// Compresses note <title>: the sealed segments of a log note, or a whole
+/// plain note packed into frames.
+///
+/// Args:
+/// - 'title': The name of the note.
+void compressNote(const string& title) {
+    const auto filePath = saveDir / (title + noteExt);
+    LogNote log;
+    PackedNote packed;
+    error_code error;
+
+    if (LogNote::exists(title) && log.load(title)) {
+        const uint64_t saved = log.compressSealed();
+        cout << title << ": " << saved / 1024 << " KB saved.\n\n";
+    } else if (PackedNote::exists(title)) {
+        cout << "'" << title << "' is already compressed.\n\n";
+    } else if (!fs::exists(filePath)) {
+        cout << "ERROR: '" << title << "' does not exist.\n";
+        suggestTitles(title);
+        cout << "\n";
+    } else if (const uintmax_t size = fs::file_size(filePath, error);
+               PackedNote::pack(title) && packed.load(title)) {
+        logger.log(LogLevel::Info, "note_packed", {
+            {"note", title}, {"frames", to_string(packed.frameCount())}});
+        cout << title << ": " << size / 1024 << " KB packed into "
+             << fs::file_size(PackedNote::pathOf(title), error) / 1024
+             << " KB in " << packed.frameCount() << " frames.\n\n";
+    } else {
+        logger.log(LogLevel::Error, "pack_failed", {
+            {"note", title}, {"error", strerror(errno)}});
+        cout << "ERROR: '" << title << "' could not be compressed.\n\n";
+    }
+}
+
+/// Prints lines <from> to <to> of the body of note <title>, for
+/// 'view <note> <from>[-<to>]'. Packed notes only decompress the frames
+/// holding those lines; other notes are read up to them.
+///
+/// Args:
+/// - 'arg': The note's name, then the first line and optionally the last,
+///   counting from the first line of the body. Shows 20 lines by default.
+void viewLines(const string& arg) {
+    const string title = arg.substr(0, arg.find(' '));
+    const string range = extractArg(arg);
+    const uint64_t from = max<uint64_t>(1, strtoull(range.c_str(), nullptr, 10));
+    const size_t dash = range.find('-');
+    const uint64_t to = dash == string::npos
+        ? from + 19 : max<uint64_t>(from, strtoull(range.c_str() + dash + 1, nullptr, 10));
+    PackedNote packed;
+
+    if (!validateInput(title) || title.empty()) {
+        cout << "'" << title << "' is not a valid filename.\n\n";
+        return;
+    } else if (!noteExists(title)) {
+        cout << "ERROR: '" << title << "' does not exist.\n";
+        suggestTitles(title);
+        cout << "\n";
+        return;
+    }
+
+    string lines;
+
+    // The body starts on line 3 of the note, after the head and a blank line.
+    if (PackedNote::exists(title) && packed.load(title)) {
+        lines = packed.readLines(from + 2, to - from + 1);
+    } else {
+        uint64_t line = 1;
+        streamNote(title, [&](const string& chunk) {
+            for (size_t pos = 0; pos < chunk.size() && line <= to;) {
+                const size_t lineEnd = chunk.find('\n', pos);
+                const size_t end = lineEnd == string::npos ? chunk.size() : lineEnd + 1;
+                if (line >= from) lines.append(chunk, pos, end - pos);
+                if (lineEnd != string::npos) line++;
+                pos = end;
+            }
+        });
+    }
+
+    cout << lines << (lines.empty() || lines.back() == '\n' ? "" : "\n") << "\n";
+}
+
+/// Reads the timestamp at the start of <line>, such as '2026-10-18 14:05',
+/// '2026-10-18T14:05:33Z', '[2026-10-18 14:05:33]' or this program's own
+/// '2026-10-18 [14:05]', as a key that sorts in time order.
+///
+/// Returns false if <line> doesn't start with a timestamp.
+///
+/// Args:
+/// - 'line': The line being read.
+/// - 'key': Set to the time as 'YYYY-MM-DD HH:MM:SS'.
+/// - 'length': Set to the length of the timestamp, if not null.
+bool readTimestamp(const string& line, string& key, size_t* length = nullptr) {
+    size_t pos = line.compare(0, 1, "[") == 0;
+    const auto digits = [&](size_t count) {
+        for (size_t i = 0; i < count; ++i) {
+            if (pos + i >= line.size() || !isdigit(static_cast<unsigned char>(line[pos + i]))) {
+                return false;
+            }
+        }
+        pos += count;
+        return true;
+    };
+    const auto literal = [&](char c) {
+        if (pos >= line.size() || line[pos] != c) return false;
+        pos++;
+        return true;
+    };
+
+    const size_t dateStart = pos;
+    if (!digits(4) || !literal('-') || !digits(2) || !literal('-') || !digits(2)) {
+        return false;
+    }
+    key = line.substr(dateStart, 10) + " ";
+
+    if (!literal(' ') && !literal('T')) return false;
+    const bool bracket = literal('[');
+    const size_t timeStart = pos;
+    if (!digits(2) || !literal(':') || !digits(2)) return false;
+    key += line.substr(timeStart, 5);
+
+    const size_t secondsStart = pos;
+    key += literal(':') && digits(2) ? line.substr(secondsStart, 3) : ":00";
+    if (bracket && !literal(']')) return false;
+
+    if (length) *length = pos;
+    return true;
+}
+
+/// Reads a 'timeline' bound: a date, or a date and time such as
+/// '2026-10-18T14:00'. A date alone stands for the start of the day, or its
+/// end if <end> is true.
+///
+/// Returns false if <text> isn't a date.
+bool readTimeBound(const string& text, bool end, string& key) {
+    size_t length = 0;
+    if (readTimestamp(text, key, &length) && length == text.size()) return true;
+
+    if (!readTimestamp(text + " 00:00", key, &length) || length != text.size() + 6) {
+        return false;
+    }
+    if (end) key.replace(11, 8, "24:00:00");
+    return true;
+}
+
+/// Reads the timestamped lines of one note in order, a block at a time, for
+/// 'timeline'. A line without a timestamp belongs to the entry above it.
+/// The block being read can be released and is read again when needed.
+///
+/// Attributes:
+/// - 'title': The name of the note.
+/// - 'blockCount': How many blocks the note's text is in.
+/// - 'readBlock': Returns the text of one block.
+/// - 'key': The time of the current entry.
+/// - 'entry': The current entry's lines.
+class TimelineCursor {
+    private:
+        size_t nextBlock = 0;
+        string buffer;
+        size_t pos = 0;
+        size_t blockStart = 0;
+        string carry;
+        bool released = false;
+        string pendingKey;
+        string pending;
+
+        /// Reads the next whole line, without its newline.
+        bool nextLine(string& line) {
+            if (released) {
+                // Read the last block again and go back to where we were.
+                buffer = carry + readBlock(nextBlock - 1);
+                blockStart = carry.size();
+                pos = carry.empty() ? pos : 0;
+                string().swap(carry);
+                released = false;
+            }
+
+            while (true) {
+                const size_t lineEnd = buffer.find('\n', pos);
+                if (lineEnd != string::npos) {
+                    line = buffer.substr(pos, lineEnd - pos);
+                    pos = lineEnd + 1;
+                    return true;
+                }
+
+                buffer.erase(0, pos);
+                pos = 0;
+                if (nextBlock == blockCount) break;
+                blockStart = buffer.size();
+                buffer += readBlock(nextBlock++);
+            }
+
+            if (buffer.empty()) return false;
+            line = move(buffer);
+            buffer.clear();
+            return true;
+        }
+
+        /// Returns the time of the first line starting in block <i>, or an
+        /// empty string if no line there has one.
+        string firstKey(size_t i) const {
+            const string text = readBlock(i);
+            size_t start = 0;
+            if (i > 0) {
+                // The block may begin partway through a line.
+                start = text.find('\n');
+                if (start == string::npos) return "";
+                start++;
+            }
+
+            string key;
+            while (start < text.size()) {
+                size_t lineEnd = text.find('\n', start);
+                if (lineEnd == string::npos) lineEnd = text.size();
+                if (readTimestamp(text.substr(start, lineEnd - start), key)) return key;
+                start = lineEnd + 1;
+            }
+            return "";
+        }
+
+    public:
+        string title;
+        size_t blockCount = 0;
+        function<string(size_t)> readBlock;
+        string key;
+        string entry;
+
+        /// Skips to the last block that starts before <from>, found by a
+        /// binary search on the first time in each block. The note's lines
+        /// are taken to be in time order.
+        void seek(const string& from) {
+            size_t low = 0;
+            size_t high = blockCount;
+
+            while (high - low > 1) {
+                const size_t middle = low + (high - low) / 2;
+                const string first = firstKey(middle);
+                if (!first.empty() && first < from) {
+                    low = middle;
+                } else {
+                    high = middle;
+                }
+            }
+
+            nextBlock = low;
+            buffer.clear();
+            pos = 0;
+            blockStart = 0;
+            if (low > 0) {
+                string partial;
+                buffer = readBlock(nextBlock++);
+                nextLine(partial);
+            }
+        }
+
+        /// Moves to the next entry.
+        ///
+        /// Returns false at the end of the note.
+        bool advance() {
+            string line;
+            while (pending.empty()) {
+                if (!nextLine(line)) return false;
+                if (readTimestamp(line, pendingKey)) pending = line + "\n";
+            }
+
+            key = move(pendingKey);
+            entry = move(pending);
+            pending.clear();
+
+            while (nextLine(line)) {
+                if (readTimestamp(line, pendingKey)) {
+                    pending = line + "\n";
+                    break;
+                }
+                entry += line + "\n";
+            }
+            return true;
+        }
+
+        /// Returns how many bytes the cursor's buffer holds.
+        size_t held() const { return buffer.capacity() + carry.capacity(); }
+
+        /// Frees the buffer, keeping only the place in the last block read
+        /// and the start of a line begun in an earlier block.
+        void release() {
+            if (pos >= buffer.size()) {
+                pos = 0;
+            } else if (pos >= blockStart) {
+                pos -= blockStart;
+                released = true;
+            } else {
+                carry = buffer.substr(pos, blockStart - pos);
+                released = true;
+            }
+            string().swap(buffer);
+            blockStart = 0;
+        }
+};
+
+/// Sets up <cursor> to read note <title> in blocks: the segments of a log
+/// note, the frames of a packed note, or 'timelineBlockSize' bytes of a
+/// plain note.
+void openTimelineCursor(const string& title, TimelineCursor& cursor) {
+    cursor.title = title;
+
+    if (LogNote::exists(title)) {
+        auto log = make_shared<LogNote>();
+        if (!log->load(title)) return;
+        cursor.blockCount = log->sealedCount() + 1;
+        cursor.readBlock = [log](size_t i) { return log->segmentText(i); };
+
+    } else if (PackedNote::exists(title)) {
+        auto packed = make_shared<PackedNote>();
+        if (!packed->load(title)) return;
+        cursor.blockCount = (packed->size() + packedFrameSize - 1) / packedFrameSize;
+        cursor.readBlock = [packed](size_t i) {
+            return packed->read(i * packedFrameSize, packedFrameSize);
+        };
+
+    } else {
+        const fs::path filePath = saveDir / (title + noteExt);
+        error_code error;
+        const uint64_t size = fs::file_size(filePath, error);
+        if (error) return;
+        cursor.blockCount = (size + timelineBlockSize - 1) / timelineBlockSize;
+        cursor.readBlock = [filePath, size](size_t i) {
+            const uint64_t offset = i * timelineBlockSize;
+            string text(min<uint64_t>(timelineBlockSize, size - offset), '\0');
+            ifstream infile(filePath, ios::binary);
+            infile.seekg(offset);
+            infile.read(&text[0], text.size());
+            text.resize(infile.gcount());
+            metrics.bytesRead += text.size();
+            return text;
+        };
+    }
+}
+
+/// Prints, in time order, every timestamped line written between two times
+/// in some or all notes, for 'timeline <from> <to> [note ...]'.
+///
+/// Each note is read by its own cursor, which first seeks close to <from>;
+/// a heap holding each cursor's next entry then merges them. Lines are
+/// printed as they are merged. A cursor holds at most one block, and once
+/// all of them hold more than 'timelineBufferBudget' bytes the least
+/// recently used ones release theirs, so memory stays bounded however many
+/// notes are read.
+///
+/// Args:
+/// - 'arg': The start time, the end time (not included), then the notes to
+///   read, or none to read every note.
+void printTimeline(const string& arg) {
+    istringstream words(arg);
+    string fromText, toText, from, to, title;
+    words >> fromText >> toText;
+
+    if (!readTimeBound(fromText, false, from) || !readTimeBound(toText, true, to)) {
+        cout << "ERROR: Use 'timeline [from] [to] [note ...]', with times like "
+                "2026-10-18 or 2026-10-18T14:00.\n\n";
+        return;
+    }
+
+    vector<string> titles;
+    while (words >> title) {
+        if (!validateInput(title)) {
+            cout << "'" << title << "' is not a valid filename.\n\n";
+            return;
+        } else if (!noteExists(title)) {
+            cout << "ERROR: '" << title << "' does not exist.\n";
+            suggestTitles(title);
+            cout << "\n";
+            return;
+        }
+        titles.push_back(title);
+    }
+
+    if (titles.empty() && fs::is_directory(saveDir)) {
+        for (const auto& entry : fs::directory_iterator(saveDir)) {
+            if (isNoteEntry(entry)) titles.push_back(entry.path().stem().string());
+        }
+        sort(titles.begin(), titles.end());
+    }
+
+    vector<TimelineCursor> cursors(titles.size());
+    vector<size_t> heap;
+    const auto later = [&](size_t a, size_t b) {
+        return cursors[a].key != cursors[b].key ? cursors[a].key > cursors[b].key : a > b;
+    };
+
+    // Cursors holding a buffer, least recently used first, each with the
+    // use it was queued for; older copies are skipped.
+    deque<pair<size_t, size_t>> holders;
+    vector<size_t> lastUse(titles.size(), 0);
+    size_t uses = 0;
+    size_t buffered = 0;
+
+    // Moves cursor <i> to its first entry from <from> on, and puts it on the
+    // heap if that entry is before <to>.
+    const auto queue = [&](size_t i) {
+        TimelineCursor& cursor = cursors[i];
+        buffered -= cursor.held();
+
+        bool queued = false;
+        while (cursor.advance()) {
+            if (cursor.key < from) continue;
+            if (cursor.key >= to) break;
+
+            heap.push_back(i);
+            push_heap(heap.begin(), heap.end(), later);
+            queued = true;
+            break;
+        }
+
+        if (!queued) cursor.release();
+        buffered += cursor.held();
+        if (queued) {
+            lastUse[i] = ++uses;
+            holders.emplace_back(i, uses);
+        }
+
+        while (buffered > timelineBufferBudget && !holders.empty()) {
+            const auto [oldest, use] = holders.front();
+            holders.pop_front();
+            if (use != lastUse[oldest]) continue;
+
+            buffered -= cursors[oldest].held();
+            cursors[oldest].release();
+        }
+    };
+
+    for (size_t i = 0; i < titles.size(); ++i) {
+        openTimelineCursor(titles[i], cursors[i]);
+        cursors[i].seek(from);
+        queue(i);
+    }
+
+    size_t printed = 0;
+    while (!heap.empty()) {
+        pop_heap(heap.begin(), heap.end(), later);
+        const size_t i = heap.back();
+        heap.pop_back();
+
+        cout << cursors[i].title << ": " << cursors[i].entry;
+        printed++;
+        queue(i);
+    }
+
+    if (printed == 0) cout << "No timestamped lines in that time.\n";
+    cout << "\n";
+}
+
+/// Prints the outline of note <title>, one numbered heading per line.
+///
+/// Args:
+/// - 'title': The name of the note.
+void printOutline(const string& title) {
+    if (LogNote::exists(title)) {
+        cout << "ERROR: Log notes have no outline; use 'tail " << title
+             << "'.\n\n";
+        return;
+    } else if (!noteExists(title)) {
+        cout << "ERROR: '" << title << "' does not exist.\n";
+        suggestTitles(title);
+        cout << "\n";
+        return;
+    }
+
+    const Outline outline = ensureOutline(title);
+    if (outline.entries.empty()) cout << "(no headings)\n";
+
+    for (size_t i = 0; i < outline.entries.size(); ++i) {
+        const auto& entry = outline.entries[i];
+        cout << string((entry.level - 1) * 2, ' ') << i + 1 << ". "
+             << entry.heading << "\n";
+    }
+
+    cout << "\n";
+}
+
+/// Prints a note, or only one of its sections for '<note>#<section>'. The
+/// section is found through the note's outline and read by seeking to it.
+///
+/// Args:
+/// - 'arg': The note's name, then optionally '#' and the section's number
+///   in the outline or its heading (case-insensitive, or a prefix of it).
+void openSection(const string& arg) {
+    const size_t hash = arg.find('#');
+    const string title = arg.substr(0, hash);
+    const string section = hash == string::npos ? "" : arg.substr(hash + 1);
+    const auto filePath = noteFile(title);
+
+    if (!validateInput(title) || title.empty()) {
+        cout << "'" << title << "' is not a valid filename.\n\n";
+        return;
+    } else if (!noteExists(title)) {
+        cout << "ERROR: '" << title << "' does not exist.\n";
+        suggestTitles(title);
+        cout << "\n";
+        return;
+    }
+
+    if (section.empty()) {
+        streamNote(title, [](const string& chunk) { cout << chunk; });
+        cout << "\n";
+        return;
+    } else if (LogNote::exists(title)) {
+        cout << "ERROR: Log notes have no sections.\n\n";
+        return;
+    }
+
+    const Outline outline = ensureOutline(title);
+    const auto& entries = outline.entries;
+    const string wanted = toLower(section);
+    size_t found = entries.size();
+
+    if (all_of(wanted.begin(), wanted.end(), ::isdigit)) {
+        const size_t number = strtoull(wanted.c_str(), nullptr, 10);
+        if (number >= 1 && number <= entries.size()) found = number - 1;
+    } else {
+        for (size_t i = 0; i < entries.size() && found == entries.size(); ++i) {
+            if (toLower(entries[i].heading) == wanted) found = i;
+        }
+        for (size_t i = 0; i < entries.size() && found == entries.size(); ++i) {
+            if (toLower(entries[i].heading).compare(0, wanted.length(), wanted) == 0) {
+                found = i;
+            }
+        }
+    }
+
+    if (found == entries.size()) {
+        cout << "ERROR: '" << title << "' has no section '" << section
+             << "'. See 'outline " << title << "'.\n\n";
+        return;
+    }
+
+    // The section runs until the next heading at the same or a higher level.
+    PackedNote packed;
+    const bool isPacked = filePath.extension() == packedExt && packed.load(title);
+    uint64_t end = isPacked ? packed.size() : outline.scanned;
+    for (size_t i = found + 1; i < entries.size(); ++i) {
+        if (entries[i].level <= entries[found].level) {
+            end = entries[i].offset;
+            break;
+        }
+    }
+
+    // A packed note decompresses only the frames the section is in.
+    if (isPacked) {
+        cout << packed.read(entries[found].offset, end - entries[found].offset) << "\n";
+        return;
+    }
+
+    ifstream infile(filePath, ios::binary);
+    infile.seekg(entries[found].offset);
+    string chunk;
+
+    for (uint64_t left = end - entries[found].offset; left > 0 && infile;) {
+        chunk.resize(min<uint64_t>(left, streamChunkSize));
+        infile.read(&chunk[0], chunk.size());
+        chunk.resize(infile.gcount());
+        metrics.bytesRead.fetch_add(chunk.size(), memory_order_relaxed);
+        cout << chunk;
+        left -= chunk.size();
+        if (chunk.empty()) break;
+    }
+
+    cout << "\n";
+}
+
+/// Creates a new note and opens it.
+///
+/// Args:
+/// - 'title': The given name of the new note.
+void createNote(const string& title) {
+    if (noteExists(title)) {
+        cout << "ERROR: '" << title << "' already exists.\n\n";
+    } else {
+        Note note(title, getCurrentTime(), "");
+        note.setContent(note.getName() + headSep + note.getTimestamp() + "\n\n");
+        openNote(note);
+    }
+}
+
+/// Loads a note from the current directory.
+///
+/// Args:
+/// - 'title': The name of the requested note.
+/// - 'appendMode': True if user is appending, false if user is overwriting.
+void loadNote(const string& title, const bool& appendMode) {
+    if (LogNote::exists(title)) {
+        openLogNote(title, appendMode);
+        return;
+    }
+
+    // Overwriting a packed note turns it back into a plain one.
+    PackedNote packed;
+    if (PackedNote::exists(title) && appendMode) {
+        openPackedNote(title);
+        return;
+    } else if (PackedNote::exists(title) && packed.load(title)) {
+        // The packed file only goes once the plain one is safely written.
+        const fs::path plainPath = saveDir / (title + noteExt);
+        ofstream outfile(plainPath);
+        outfile << packed.head() << "\n\n";
+        outfile.close();
+        error_code error;
+
+        if (!outfile) {
+            fs::remove(plainPath, error);
+            logger.log(LogLevel::Error, "unpack_failed", {
+                {"note", title}, {"path", plainPath.string()},
+                {"error", strerror(errno)}});
+            cout << "ERROR: '" << title << "' failed to load.\n\n";
+            return;
+        }
+        syncFile(plainPath);
+        fs::remove(PackedNote::pathOf(title), error);
+    }
+
+    const auto filePath = saveDir / (title + noteExt);
+    ifstream infile(filePath);
+    string head;
+    string line;
+    string loadedContent;
+
+    if (infile.is_open()) {
+        system(clearScreen);
+        getline(infile, head);
+
+        size_t sep = head.find(headSep);
+        Note note(title, head.substr(sep + headSep.length()), "");
+
+        // Large notes are appended to in place rather than loaded whole.
+        if (appendMode && fs::file_size(filePath) > largeNoteThreshold) {
+            infile.close();
+            note.setContent(head + "\n\n");
+            openLargeNote(note, filePath);
+            return;
+        }
+        
+        if (appendMode) {
+            for (int i = 1; getline(infile, line); ++i) {
+                loadedContent += line + "\n";
+            }
+        } else {
+            loadedContent = "\n";
+        }
+
+        metrics.bytesRead.fetch_add(loadedContent.size(), memory_order_relaxed);
+        note.setContent(head + "\n" + loadedContent);
+        openNote(note);
+
+    } else {
+        logger.log(LogLevel::Warn, "load_failed", {
+            {"note", title}, {"path", filePath.string()},
+            {"error", strerror(errno)}});
+        cout << "ERROR: '" << title << "' does not exist or "
+                "failed to load.\n";
+        suggestTitles(title);
+        cout << "\n";
+    }
+}
+
+/// The generations a cached result depends on.
+enum CacheDependency : unsigned {
+    DependsOnTitles = 1,
+    DependsOnTags = 2,
+    DependsOnWords = 4,
+    DependsOnBodies = 8
+};
+
+/// Remembers the titles returned by recent listings and queries, keyed by
+/// the normalized query, so repeating one doesn't touch any index.
+///
+/// An entry is current while the store generation is the one it was
+/// computed at. After any save or delete it is still current if none of
+/// the generations it depends on moved, e.g. a tag query survives an edit
+/// that changed no tags. The least recently used entries are dropped once
+/// there are 'capacity' of them.
+///
+/// Attributes:
+/// - 'order': The entries, most recently used first.
+/// - 'entries': Where each query's entry sits in 'order'.
+/// - 'hits', 'misses': How many lookups found or missed a current entry.
+class ResultCache {
+    private:
+        static constexpr size_t capacity = 256;
+
+        struct Entry {
+            string key;
+            vector<string> titles;
+            unsigned dependencies;
+            StoreGenerations seen;
+        };
+
+        list<Entry> order;
+        unordered_map<string, list<Entry>::iterator> entries;
+        size_t bytes = 0;
+        size_t hits = 0;
+        size_t misses = 0;
+
+        static size_t entryBytes(const Entry& entry) {
+            size_t size = sizeof(Entry) + 2 * entry.key.capacity() + 64;
+            for (const auto& title : entry.titles) {
+                size += sizeof(string) + title.capacity();
+            }
+            return size;
+        }
+
+        static bool isCurrent(Entry& entry) {
+            const StoreGenerations& now = generations;
+            if (entry.seen.store == now.store) return true;
+
+            if (((entry.dependencies & DependsOnTitles) &&
+                 entry.seen.titles != now.titles) ||
+                ((entry.dependencies & DependsOnTags) &&
+                 entry.seen.tags != now.tags) ||
+                ((entry.dependencies & DependsOnWords) &&
+                 entry.seen.words != now.words) ||
+                ((entry.dependencies & DependsOnBodies) &&
+                 entry.seen.bodies != now.bodies)) {
+                return false;
+            }
+
+            entry.seen = now;
+            return true;
+        }
+
+        void erase(list<Entry>::iterator entry) {
+            bytes -= entryBytes(*entry);
+            entries.erase(entry->key);
+            order.erase(entry);
+        }
+
+    public:
+        size_t memoryUsage() const { return bytes; }
+        size_t size() const { return entries.size(); }
+        size_t hitCount() const { return hits; }
+        size_t missCount() const { return misses; }
+
+        /// Returns the cached titles for <key>, or null if there are none
+        /// or they are out of date.
+        const vector<string>* find(const string& key) {
+            const auto found = entries.find(key);
+
+            if (found == entries.end()) {
+                misses++;
+                return nullptr;
+            }
+
+            if (!isCurrent(*found->second)) {
+                erase(found->second);
+                misses++;
+                return nullptr;
+            }
+
+            order.splice(order.begin(), order, found->second);
+            hits++;
+            return &found->second->titles;
+        }
+
+        /// Caches <titles> as the result of <key>.
+        void store(const string& key, const vector<string>& titles,
+                   unsigned dependencies) {
+            const auto found = entries.find(key);
+            if (found != entries.end()) erase(found->second);
+
+            order.push_front({key, titles, dependencies, generations});
+            entries[key] = order.begin();
+            bytes += entryBytes(order.front());
+
+            if (order.size() > capacity) erase(prev(order.end()));
+        }
+
+        void clear() {
+            order.clear();
+            entries.clear();
+            bytes = 0;
+        }
+};
+
+ResultCache resultCache; // Results of recent listings and queries.
+
+/// Prints a list of note titles, or <emptyMessage> if there are none.
+///
+/// Args:
+/// - 'titles': The titles being printed.
+/// - 'emptyMessage': What to print when <titles> is empty.
+void printTitles(const vector<string>& titles, const string& emptyMessage) {
+    if (titles.empty()) {
+        cout << emptyMessage << "\n\n";
+        return;
+    }
+
+    for (const auto& title : titles) cout << "> " << title << "\n";
+    cout << "\n";
+}
+
+/// Caches <titles> as the result of <key> and records the cache's new size.
+void cacheResult(const string& key, const vector<string>& titles,
+                 unsigned dependencies) {
+    resultCache.store(key, titles, dependencies);
+    governor.set(Subsystem::QueryCache, resultCache.memoryUsage());
+}
+
+/// The parts of a note store that listings and queries read.
+///
+/// Attributes:
+/// - 'name': The name the store is mounted under; empty for the home store.
+/// - 'dir': The store's directory.
+struct StoreView {
+    string name;
+    fs::path dir;
+    const Catalog& catalog;
+    const NoteIds& ids;
+    const PostingIndex& tags;
+    const PostingIndex& words;
+};
+
+/// Returns the view of the home store, 'saveDir', made of the global indexes.
+StoreView homeStore() {
+    return {"", saveDir, catalog, noteIds, tagIndex, wordIndex};
+}
+
+/// Another note store mounted under a name with 'mount', so listings and
+/// queries take in its notes too. Mounted stores are read-only and only
+/// their plain notes are read. Their indexes are built on first use and
+/// kept until the store is unmounted or mounted again.
+class MountedStore {
+    private:
+        Catalog catalog;
+        NoteIds ids;
+        PostingIndex tags;
+        PostingIndex words;
+        bool loaded = false;
+
+    public:
+        const string name;
+        const fs::path dir;
+
+        MountedStore(const string& name, const fs::path& dir) : name(name), dir(dir) {}
+
+        StoreView view() const { return {name, dir, catalog, ids, tags, words}; }
+        size_t count() const { return catalog.count(); }
+
+        /// Builds the store's catalog and indexes if they aren't built.
+        void ensureLoaded() {
+            if (loaded) return;
+
+            vector<CatalogEntry> entries;
+            error_code error;
+
+            for (fs::directory_iterator it(dir, error), end; !error && it != end;
+                 it.increment(error)) {
+                if (it->path().extension() != noteExt) continue;
+
+                CatalogEntry entry;
+                entry.title = it->path().stem().string();
+                entry.id = ids.idFor(entry.title);
+                entry.size = it->file_size(error);
+
+                ifstream infile(it->path());
+                string head;
+                getline(infile, head);
+                const size_t sep = head.find(headSep);
+                if (sep != string::npos) {
+                    entry.created = parseTimestamp(head.substr(sep + headSep.length()));
+                }
+
+                set<string> noteTags;
+                set<string> terms;
+                streamNoteBody(it->path(), [&](const string& chunk) {
+                    const set<string> chunkTags = extractTags(chunk);
+                    noteTags.insert(chunkTags.begin(), chunkTags.end());
+                    const set<string> chunkTerms = extractTerms(chunk);
+                    terms.insert(chunkTerms.begin(), chunkTerms.end());
+                });
+                tags.setKeys(entry.id, noteTags);
+                words.setKeys(entry.id, terms);
+                entries.push_back(entry);
+            }
+
+            catalog.build(move(entries));
+            loaded = true;
+        }
+
+        /// Drops the indexes; they are built again on next use.
+        void unload() {
+            catalog.clear();
+            tags.clear();
+            words.clear();
+            loaded = false;
+        }
+
+        size_t memoryUsage() const {
+            return catalog.memoryUsage() + tags.memoryUsage() + words.memoryUsage();
+        }
+};
+
+vector<unique_ptr<MountedStore>> mounts; // Stores mounted with 'mount'.
+bool searchingMounts = false; // Mounted stores are in use; don't unload them.
+
+/// Records how much memory the mounted stores hold with the governor.
+void chargeMounts() {
+    size_t bytes = 0;
+    for (const auto& store : mounts) bytes += store->memoryUsage();
+    governor.set(Subsystem::Mounts, bytes);
+}
+
+/// Mounts the note store in a directory under a name, so listings and
+/// queries include its notes. Mounting a name again replaces its store.
+///
+/// Args:
+/// - 'arg': The name followed by the directory, e.g. 'work /mnt/work/notes'.
+void mountStore(const string& arg) {
+    const size_t space = arg.find(' ');
+    const string name = arg.substr(0, space);
+    const fs::path dir = space == string::npos ? "" : arg.substr(space + 1);
+
+    if (dir.empty() || !validateInput(name)) {
+        cout << "ERROR: Use 'mount [name] [directory]'.\n\n";
+        return;
+    }
+
+    error_code error;
+    if (!fs::is_directory(dir, error)) {
+        cout << "ERROR: '" << dir.string() << "' is not a directory.\n\n";
+        return;
+    }
+
+    if (fs::equivalent(dir, saveDir, error)) {
+        cout << "ERROR: '" << dir.string() << "' is already the home store.\n\n";
+        return;
+    }
+
+    const auto found = find_if(mounts.begin(), mounts.end(),
+                               [&](const auto& store) { return store->name == name; });
+    auto store = make_unique<MountedStore>(name, dir);
+    if (found != mounts.end()) {
+        *found = move(store);
+    } else {
+        mounts.push_back(move(store));
+    }
+    chargeMounts();
+
+    logger.log(LogLevel::Info, "store_mounted", {{"name", name}, {"dir", dir.string()}});
+    cout << "Mounted '" << dir.string() << "' as '" << name << "'.\n\n";
+}
+
+/// Unmounts the store mounted as <name>.
+void unmountStore(const string& name) {
+    const auto found = find_if(mounts.begin(), mounts.end(),
+                               [&](const auto& store) { return store->name == name; });
+
+    if (found == mounts.end()) {
+        cout << "ERROR: No store is mounted as '" << name << "'.\n\n";
+        return;
+    }
+
+    mounts.erase(found);
+    chargeMounts();
+
+    logger.log(LogLevel::Info, "store_unmounted", {{"name", name}});
+    cout << "Unmounted '" << name << "'.\n\n";
+}
+
+/// Prints the mounted stores and how many notes each has, if loaded.
+void listMounts() {
+    if (mounts.empty()) {
+        cout << "No stores mounted.\n\n";
+        return;
+    }
+
+    for (const auto& store : mounts) {
+        cout << "> " << store->name << ": " << store->dir.string();
+        if (store->memoryUsage() > 0) cout << " (" << store->count() << " notes)";
+        cout << "\n";
+    }
+    cout << "\n";
+}
+
+/// Merges the sorted title lists found in each store into one sorted list
+/// of at most <limit> titles, with a heap holding the next title of each
+/// store. Titles from mounted stores are shown as '<store>:<title>'.
+///
+/// Returns the merged titles; <omitted> is set to how many didn't fit.
+///
+/// Args:
+/// - 'results': The titles found in each store, home store first.
+/// - 'limit': The most titles to return.
+/// - 'omitted': Set to the number of titles left out.
+vector<string> mergeResults(const vector<vector<string>>& results, size_t limit,
+                            size_t& omitted) {
+    using Head = pair<const string*, size_t>;
+    const auto later = [](const Head& a, const Head& b) {
+        return *a.first != *b.first ? *a.first > *b.first : a.second > b.second;
+    };
+    vector<Head> heap;
+    vector<size_t> next(results.size(), 0);
+    size_t total = 0;
+
+    for (size_t i = 0; i < results.size(); ++i) {
+        total += results[i].size();
+        if (!results[i].empty()) heap.push_back({&results[i][0], i});
+    }
+    make_heap(heap.begin(), heap.end(), later);
+
+    vector<string> merged;
+    while (!heap.empty() && merged.size() < limit) {
+        pop_heap(heap.begin(), heap.end(), later);
+        const size_t store = heap.back().second;
+        heap.pop_back();
+
+        const string& title = results[store][next[store]++];
+        merged.push_back(store == 0 ? title : mounts[store - 1]->name + ":" + title);
+
+        if (next[store] < results[store].size()) {
+            heap.push_back({&results[store][next[store]], store});
+            push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+
+    omitted = total - merged.size();
+    return merged;
+}
+
+/// Runs a listing or query on the home store and on every mounted store in
+/// parallel, and prints the merged results.
+///
+/// Args:
+/// - 'searchHome': Returns the matching titles of the home store, sorted.
+/// - 'searchMounted': Returns up to <limit> matching titles of the given
+///   mounted store, sorted. One more than 'maxMergedResults' is asked for,
+///   to tell whether a store had more than could be shown.
+/// - 'emptyMessage': What to print when nothing matches.
+void printAcrossStores(const function<vector<string>()>& searchHome,
+                       const function<vector<string>(const StoreView&, size_t)>& searchMounted,
+                       const string& emptyMessage) {
+    if (mounts.empty()) {
+        printTitles(searchHome(), emptyMessage);
+        return;
+    }
+
+    // Each task only touches its own store, so they can run side by side.
+    // The home search may make the governor evict, which must not unload a
+    // mounted store another task is reading.
+    vector<vector<string>> results(mounts.size() + 1);
+    searchingMounts = true;
+    runParallel(results.size(), [&](size_t i) {
+        if (i == 0) {
+            results[0] = searchHome();
+        } else {
+            mounts[i - 1]->ensureLoaded();
+            results[i] = searchMounted(mounts[i - 1]->view(), maxMergedResults + 1);
+        }
+    });
+    searchingMounts = false;
+    chargeMounts();
+
+    size_t omitted = 0;
+    const vector<string> merged = mergeResults(results, maxMergedResults, omitted);
+    if (omitted == 0) {
+        printTitles(merged, emptyMessage);
+        return;
+    }
+
+    const bool capped = any_of(results.begin() + 1, results.end(), [](const auto& found) {
+        return found.size() > maxMergedResults;
+    });
+    for (const auto& title : merged) cout << "> " << title << "\n";
+    cout << "... (" << (capped ? "at least " : "") << omitted << " more not shown)\n\n";
+}
+
+/// Returns the first <limit> titles of <store>, in order.
+vector<string> listTitles(const StoreView& store, size_t limit) {
+    vector<string> titles;
+
+    store.catalog.forEach("", [&](const CatalogEntry& entry) {
+        titles.push_back(entry.title);
+        return titles.size() < limit;
+    });
+
+    return titles;
+}
+
+/// Prints a list of all saved notes to the user.
+void listNotes() {
+    if (!fs::exists(saveDir) || !fs::is_directory(saveDir)) {
+        cout << "ERROR: Could not find save directory.\n\n";
+        return;
+    }
+
+    const auto searchHome = [] {
+        if (const auto cached = resultCache.find("ls")) return *cached;
+
+        ensureCatalog();
+        const vector<string> titles = listTitles(homeStore(), SIZE_MAX);
+        cacheResult("ls", titles, DependsOnTitles);
+        return titles;
+    };
+
+    printAcrossStores(searchHome, [](const StoreView& store, size_t limit) {
+        return listTitles(store, limit);
+    }, "No files found.");
+}
+
+/// Prints how much memory the catalog takes per note, next to what the same
+/// notes would take held as Note objects with an empty content.
+void reportCatalog() {
+    ensureCatalog();
+
+    // Heap bytes of a string holding <length> chars, malloc header included.
+    const auto stringHeap = [](size_t length) -> size_t {
+        return length < sizeof(string) / 2 ? 0 : (length + 16) / 16 * 16 + 16;
+    };
+
+    const size_t timestampLength = string("2000-01-01 [00:00]").length();
+    size_t notes = 0;
+    size_t asObjects = 0;
+
+    catalog.forEach("", [&](const CatalogEntry& entry) {
+        notes++;
+        asObjects += sizeof(Note) + stringHeap(entry.title.length()) +
+                     stringHeap(timestampLength);
+        return true;
+    });
+
+    if (notes == 0) return;
+
+    cout << "Catalog: " << notes << " notes, "
+         << catalog.memoryUsage() / notes << " bytes each ("
+         << asObjects / notes << " as Note objects).\n";
+}
+
+/// Sorts <titles> and keeps the first <limit> of them.
+vector<string> sortedPrefix(vector<string> titles, size_t limit) {
+    if (titles.size() > limit) {
+        partial_sort(titles.begin(), titles.begin() + limit, titles.end());
+        titles.resize(limit);
+    } else {
+        sort(titles.begin(), titles.end());
+    }
+    return titles;
+}
+
+/// Returns the first <limit> titles, in order, of the notes in <store>
+/// carrying every tag in <required>, at least one in <anyOf> (if it isn't
+/// empty) and none in <excluded>.
+vector<string> notesWithTags(const StoreView& store, vector<string> required,
+                             const vector<string>& anyOf,
+                             const vector<string>& excluded, size_t limit) {
+    // Start from the rarest required tag so every AND shrinks a small set.
+    sort(required.begin(), required.end(), [&](const auto& a, const auto& b) {
+        return store.tags.notesWith(a).cardinality() <
+               store.tags.notesWith(b).cardinality();
+    });
+
+    Bitmap matches = required.empty() ? store.tags.allNotes()
+                                      : store.tags.notesWith(required[0]);
+
+    for (size_t i = 1; i < required.size() && !matches.empty(); ++i) {
+        matches = matches & store.tags.notesWith(required[i]);
+    }
+
+    if (!anyOf.empty()) {
+        Bitmap any;
+        for (const auto& tag : anyOf) any = any | store.tags.notesWith(tag);
+        matches = matches & any;
+    }
+
+    for (const auto& tag : excluded) {
+        matches = matches - store.tags.notesWith(tag);
+    }
+
+    vector<string> titles;
+    for (uint32_t id : matches.values()) titles.push_back(store.ids.titleOf(id));
+    return sortedPrefix(move(titles), limit);
+}
+
+/// Lists the notes whose tags match a query such as
+/// '--tag a --tag b --any c --any d --not e': notes carrying every '--tag',
+/// at least one '--any' (if any are given) and no '--not'.
+///
+/// Args:
+/// - 'query': The filters given to 'ls'.
+void listTaggedNotes(const string& query) {
+    istringstream stream(query);
+    string flag;
+    string tag;
+    vector<string> required;
+    vector<string> anyOf;
+    vector<string> excluded;
+
+    while (stream >> flag) {
+        if (!(stream >> tag) || tag.empty()) {
+            cout << "ERROR: '" << flag << "' needs a tag.\n\n";
+            return;
+        }
+
+        if (tag[0] == '#') tag.erase(0, 1);
+        tag = toLower(tag);
+
+        if (flag == "--tag") {
+            required.push_back(tag);
+        } else if (flag == "--any") {
+            anyOf.push_back(tag);
+        } else if (flag == "--not") {
+            excluded.push_back(tag);
+        } else {
+            cout << "ERROR: Unknown filter '" << flag << "'.\n\n";
+            return;
+        }
+    }
+
+    // The same filters in any order and case share one cache entry.
+    string key = "ls";
+    for (auto* tags : {&required, &anyOf, &excluded}) {
+        sort(tags->begin(), tags->end());
+        key += "|";
+        for (const auto& tag : *tags) key += tag + ",";
+    }
+
+    const auto searchHome = [&] {
+        if (const auto cached = resultCache.find(key)) return *cached;
+
+        ensureIndexes();
+        const vector<string> titles = notesWithTags(homeStore(), required, anyOf,
+                                                    excluded, SIZE_MAX);
+        cacheResult(key, titles, DependsOnTitles | DependsOnTags);
+        return titles;
+    };
+
+    printAcrossStores(searchHome, [&](const StoreView& store, size_t limit) {
+        return notesWithTags(store, required, anyOf, excluded, limit);
+    }, "No notes match.");
+}
+
+/// Checks if <text> matches <pattern>, where '*' matches any run of
+/// characters and '?' matches any one character.
+///
+/// Args:
+/// - 'pattern': The glob pattern.
+/// - 'text': The text being matched.
+bool globMatch(const string& pattern, const string& text) {
+    size_t p = 0;
+    size_t t = 0;
+    size_t star = string::npos;
+    size_t starText = 0;
+
+    while (t < text.length()) {
+        if (p < pattern.length() && (pattern[p] == '?' || pattern[p] == text[t])) {
+            p++;
+            t++;
+        } else if (p < pattern.length() && pattern[p] == '*') {
+            star = p++;
+            starText = t;
+        } else if (star != string::npos) {
+            p = star + 1;
+            t = ++starText;
+        } else {
+            return false;
+        }
+    }
+
+    while (p < pattern.length() && pattern[p] == '*') p++;
+    return p == pattern.length();
+}
+
+/// Reads a date such as '2026', '2026-09' or '2026-09-14' as a time in
+/// minutes since the epoch.
+///
+/// Returns false if <text> is not a date.
+///
+/// Args:
+/// - 'text': The date being read.
+/// - 'end': True for the end of the period <text> names, false for its start.
+/// - 'minutes': Set to the time that was read.
+bool parseDateBound(const string& text, bool end, uint32_t& minutes) {
+    int year = 0;
+    int month = 1;
+    int day = 1;
+    char extra;
+    const int fields = sscanf(text.c_str(), "%d-%d-%d%c", &year, &month, &day,
+                              &extra);
+    if (fields < 1 || fields > 3 || year < 1970 || year > 9999 || month < 1 ||
+        month > 12 || day < 1 || day > 31) {
+        return false;
+    }
+
+    // mktime() would move a day past the end of its month into the next.
+    tm check_tm = {};
+    check_tm.tm_year = year - 1900;
+    check_tm.tm_mon = month - 1;
+    check_tm.tm_mday = day;
+    check_tm.tm_hour = 12;
+    check_tm.tm_isdst = -1;
+    if (mktime(&check_tm) < 0 || check_tm.tm_mday != day) return false;
+
+    tm local_tm = {};
+    local_tm.tm_year = year - 1900 + (end && fields == 1);
+    local_tm.tm_mon = month - 1 + (end && fields == 2);
+    local_tm.tm_mday = day + (end && fields == 3);
+    local_tm.tm_isdst = -1;
+
+    const time_t seconds = mktime(&local_tm);
+    if (seconds < 0) return false;
+
+    minutes = static_cast<uint32_t>(seconds / 60);
+    return true;
+}
+
+/// One condition of a 'query'.
+///
+/// Attributes:
+/// - 'kind': What the condition looks at: "tag", "title", "since", "until"
+///   or "text".
+/// - 'value': What the condition looks for.
+/// - 'estimate': How many notes the planner expects to match.
+struct QueryPredicate {
+    string kind;
+    string value;
+    size_t estimate = 0;
+};
+
+/// Splits a query into its conditions. Words are separated by spaces, and
+/// double quotes keep a phrase together.
+///
+/// Returns false, after printing why, if the query can't be read.
+///
+/// Args:
+/// - 'query': The query the user typed.
+/// - 'predicates': Filled with the conditions of the query.
+bool parseQuery(const string& query, vector<QueryPredicate>& predicates) {
+    size_t i = 0;
+
+    while (i < query.length()) {
+        if (isspace(static_cast<unsigned char>(query[i]))) {
+            i++;
+            continue;
+        }
+
+        QueryPredicate predicate;
+
+        if (query[i] == '"') {
+            const size_t close = query.find('"', i + 1);
+            if (close == string::npos) {
+                cout << "ERROR: Missing closing quote.\n\n";
+                return false;
+            }
+            predicate.kind = "text";
+            predicate.value = query.substr(i + 1, close - i - 1);
+            i = close + 1;
+        } else {
+            size_t end = i;
+            while (end < query.length() &&
+                   !isspace(static_cast<unsigned char>(query[end]))) {
+                end++;
+            }
+            const string word = query.substr(i, end - i);
+            const size_t colon = word.find(':');
+            i = end;
+
+            predicate.kind = colon == string::npos ? "text" : word.substr(0, colon);
+            predicate.value = colon == string::npos ? word : word.substr(colon + 1);
+        }
+
+        if (predicate.kind != "tag" && predicate.kind != "title" &&
+            predicate.kind != "since" && predicate.kind != "until" &&
+            predicate.kind != "text") {
+            cout << "ERROR: Unknown condition '" << predicate.kind << ":'.\n\n";
+            return false;
+        }
+
+        if (predicate.kind == "tag" && predicate.value[0] == '#') {
+            predicate.value.erase(0, 1);
+        }
+
+        if (predicate.value.empty()) {
+            cout << "ERROR: '" << predicate.kind << ":' needs a value.\n\n";
+            return false;
+        }
+
+        uint32_t minutes;
+        if ((predicate.kind == "since" || predicate.kind == "until") &&
+            !parseDateBound(predicate.value, predicate.kind == "until", minutes)) {
+            cout << "ERROR: '" << predicate.value << "' is not a date; use "
+                 << predicate.kind << ":2026, " << predicate.kind << ":2026-09 or "
+                 << predicate.kind << ":2026-09-14.\n\n";
+            return false;
+        }
+
+        // Tags and text are matched ignoring case.
+        if (predicate.kind == "tag" || predicate.kind == "text") {
+            predicate.value = toLower(predicate.value);
+        }
+
+        predicates.push_back(predicate);
+    }
+
+    if (predicates.empty()) {
+        cout << "ERROR: Empty query.\n\n";
+        return false;
+    }
+
+    return true;
+}
+
+/// Returns the part of a glob pattern before its first wildcard.
+string globPrefix(const string& pattern) {
+    return pattern.substr(0, pattern.find_first_of("*?"));
+}
+
+/// Returns the notes whose titles start with <prefix>, stopping early once
+/// more than <limit> are found.
+Bitmap notesWithTitlePrefix(const StoreView& store, const string& prefix,
+                            size_t limit = SIZE_MAX) {
+    Bitmap notes;
+    size_t found = 0;
+
+    store.catalog.forEach(prefix, [&](const CatalogEntry& entry) {
+        if (entry.title.compare(0, prefix.length(), prefix) != 0) return false;
+        notes.add(entry.id);
+        return ++found <= limit;
+    });
+
+    return notes;
+}
+
+/// Returns the notes that contain every indexed word of a text condition.
+Bitmap notesWithText(const StoreView& store, const string& text) {
+    const set<string> terms = extractTerms(text);
+    vector<const Bitmap*> postings;
+
+    for (const auto& term : terms) postings.push_back(&store.words.notesWith(term));
+    sort(postings.begin(), postings.end(), [](const Bitmap* a, const Bitmap* b) {
+        return a->cardinality() < b->cardinality();
+    });
+
+    Bitmap notes = *postings[0];
+    for (size_t i = 1; i < postings.size() && !notes.empty(); ++i) {
+        notes = notes & *postings[i];
+    }
+
+    return notes;
+}
+
+/// Checks if a text condition needs the note's body to be read to confirm a
+/// match, i.e. if it is more than a single indexed word.
+bool textNeedsBody(const string& text) {
+    const set<string> terms = extractTerms(text);
+    return terms.size() != 1 || *terms.begin() != toLower(text);
+}
+
+/// Checks if the body of note <title> in <store> contains <phrase>,
+/// ignoring case.
+bool noteContains(const StoreView& store, const string& title,
+                  const string& phrase) {
+    const string needle = toLower(phrase);
+    string window;
+    bool found = false;
+
+    const auto search = [&](const string& chunk) {
+        if (found) return;
+        // Keep the end of the last piece so a match across pieces is seen.
+        window = window.substr(window.length() - min(window.length(),
+                                                     needle.length())) +
+                 toLower(chunk);
+        found = window.find(needle) != string::npos;
+    };
+
+    if (store.name.empty()) {
+        streamNote(title, search);
+    } else {
+        streamNoteBody(store.dir / (title + noteExt), search);
+    }
+
+    return found;
+}
+
+/// Returns the first <limit> titles, in order, of the notes in <store> that
+/// match every condition in <predicates>.
+///
+/// Each condition's number of matches is estimated first: exactly for tags
+/// and indexed words, by a bounded catalog scan for title prefixes, and as
+/// half the notes for dates. The conditions are then applied from the most
+/// selective up, so the first one produces a small candidate set that each
+/// later one only shrinks. Note bodies are read last, and only for the
+/// candidates left, to confirm phrases.
+///
+/// Args:
+/// - 'store': The store being searched; its indexes must be built.
+/// - 'predicates': The conditions of the query.
+/// - 'limit': The most titles to return.
+vector<string> evaluateQuery(const StoreView& store, vector<QueryPredicate> predicates,
+                             size_t limit) {
+    const size_t total = store.catalog.count();
+    const size_t scanLimit = 4096;
+
+    for (auto& predicate : predicates) {
+        if (predicate.kind == "tag") {
+            predicate.estimate = store.tags.notesWith(predicate.value).cardinality();
+        } else if (predicate.kind == "text") {
+            predicate.estimate = total;
+            for (const auto& term : extractTerms(predicate.value)) {
+                predicate.estimate = min(predicate.estimate,
+                                         store.words.notesWith(term).cardinality());
+            }
+        } else if (predicate.kind == "title") {
+            const string prefix = globPrefix(predicate.value);
+            predicate.estimate = prefix.empty()
+                ? total
+                : notesWithTitlePrefix(store, prefix, scanLimit).cardinality();
+        } else {
+            predicate.estimate = total / 2;
+        }
+    }
+
+    stable_sort(predicates.begin(), predicates.end(),
+                [](const auto& a, const auto& b) { return a.estimate < b.estimate; });
+
+    // Conditions that can produce candidates from an index by themselves.
+    const auto hasIndex = [](const QueryPredicate& predicate) {
+        return predicate.kind == "tag" ||
+               (predicate.kind == "text" && !extractTerms(predicate.value).empty()) ||
+               (predicate.kind == "title" && !globPrefix(predicate.value).empty());
+    };
+
+    Bitmap candidates;
+    const auto first = find_if(predicates.begin(), predicates.end(), hasIndex);
+
+    if (first == predicates.end()) {
+        store.catalog.forEach("", [&](const CatalogEntry& entry) {
+            candidates.add(entry.id);
+            return true;
+        });
+    } else if (first->kind == "tag") {
+        candidates = store.tags.notesWith(first->value);
+    } else if (first->kind == "text") {
+        candidates = notesWithText(store, first->value);
+    } else {
+        candidates = notesWithTitlePrefix(store, globPrefix(first->value));
+    }
+
+    // Narrow down with the other indexes while they are cheaper than
+    // checking each candidate.
+    for (const auto& predicate : predicates) {
+        if (candidates.empty()) break;
+        if (first != predicates.end() && &predicate == &*first) continue;
+
+        if (predicate.kind == "tag") {
+            candidates = candidates & store.tags.notesWith(predicate.value);
+        } else if (predicate.kind == "text" && hasIndex(predicate)) {
+            candidates = candidates & notesWithText(store, predicate.value);
+        }
+    }
+
+    // Check the remaining conditions on each candidate, leaving the ones
+    // that read note bodies for last.
+    vector<string> titles;
+
+    for (uint32_t id : candidates.values()) {
+        const string& title = store.ids.titleOf(id);
+        const auto entry = store.catalog.find(title);
+        bool matches = entry.has_value();
+
+        for (const auto& predicate : predicates) {
+            if (!matches) break;
+            uint32_t bound;
+
+            if (predicate.kind == "title") {
+                matches = globMatch(predicate.value, title);
+            } else if (predicate.kind == "since") {
+                matches = parseDateBound(predicate.value, false, bound) &&
+                          entry->created >= bound;
+            } else if (predicate.kind == "until") {
+                matches = parseDateBound(predicate.value, true, bound) &&
+                          entry->created < bound;
+            }
+        }
+
+        for (const auto& predicate : predicates) {
+            if (!matches) break;
+            if (predicate.kind == "text" && textNeedsBody(predicate.value)) {
+                matches = noteContains(store, title, predicate.value);
+            }
+        }
+
+        if (matches) titles.push_back(title);
+    }
+
+    return sortedPrefix(move(titles), limit);
+}
+
+/// Runs a query such as 'tag:ops since:2026-09 "disk full" title:inc-*' and
+/// prints the matching notes, from the home store and any mounted ones.
+///
+/// Args:
+/// - 'query': The query the user typed.
+void runQuery(const string& query) {
+    vector<QueryPredicate> predicates;
+    if (!parseQuery(query, predicates)) return;
+
+    // The same conditions in any order share one cache entry.
+    vector<string> conditions;
+    unsigned dependencies = DependsOnTitles;
+
+    for (const auto& predicate : predicates) {
+        conditions.push_back(predicate.kind + ":" + predicate.value);
+        if (predicate.kind == "tag") dependencies |= DependsOnTags;
+        if (predicate.kind == "text") {
+            dependencies |= textNeedsBody(predicate.value) ? DependsOnBodies
+                                                           : DependsOnWords;
+        }
+    }
+
+    sort(conditions.begin(), conditions.end());
+    string key = "query";
+    for (const auto& condition : conditions) key += "|" + condition;
+
+    const auto searchHome = [&] {
+        if (const auto cached = resultCache.find(key)) return *cached;
+
+        ensureCatalog();
+        ensureIndexes();
+        const vector<string> titles = evaluateQuery(homeStore(), predicates, SIZE_MAX);
+        cacheResult(key, titles, dependencies);
+        return titles;
+    };
+
+    printAcrossStores(searchHome, [&](const StoreView& store, size_t limit) {
+        return evaluateQuery(store, predicates, limit);
+    }, "No notes match.");
+}
+
+/// Prints the notes most like note <title>, scored by the cosine similarity
+/// of their TF-IDF word vectors.
+///
+/// Args:
+/// - 'title': The name of the note.
+void relatedNotes(const string& title) {
+    if (!noteExists(title)) {
+        cout << "ERROR: '" << title << "' does not exist.\n";
+        suggestTitles(title);
+        cout << "\n";
+        return;
+    }
+
+    ensureIndexes();
+    uint32_t id;
+    const auto scores = noteIds.find(title, id) ? similarity.related(id, maxRelated)
+                                                : vector<pair<float, uint32_t>>();
+    chargeSearchIndexes();
+
+    if (scores.empty()) {
+        cout << "No related notes.\n\n";
+        return;
+    }
+
+    for (const auto& [score, other] : scores) {
+        cout << "> " << noteIds.titleOf(other) << " (" << fixed << setprecision(2)
+             << score << defaultfloat << ")\n";
+    }
+    cout << "\n";
+}
+
+/// Returns the 64-bit FNV-1a hash of <text>, continuing from <hash>.
+///
+/// Args:
+/// - 'text': The bytes being hashed.
+/// - 'hash': The hash of whatever came before <text>.
+uint64_t hashText(string_view text, uint64_t hash = 14695981039346656037ULL) {
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/// Finds every '[[title]]' link in <text> and adds the titles to <links>.
+///
+/// Args:
+/// - 'text': The text being searched.
+/// - 'links': The set the linked titles are added to.
+void extractLinks(const string& text, set<string>& links) {
+    for (size_t open = text.find("[["); open != string::npos;
+         open = text.find("[[", open + 2)) {
+        const size_t close = text.find("]]", open + 2);
+        if (close == string::npos) return;
+        if (close > open + 2) links.insert(text.substr(open + 2, close - open - 2));
+    }
+}
+
+/// Returns <text> with the characters that mean something in HTML escaped.
+string escapeHtml(const string& text) {
+    string escaped;
+    escaped.reserve(text.length());
+
+    for (char c : text) {
+        switch (c) {
+            case '&': escaped += "&amp;"; break;
+            case '<': escaped += "&lt;"; break;
+            case '>': escaped += "&gt;"; break;
+            case '"': escaped += "&quot;"; break;
+            case '\'': escaped += "&#39;"; break;
+            default: escaped += c;
+        }
+    }
+
+    return escaped;
+}
+
+/// Returns <text> percent-encoded for use as the path of a link, so that
+/// characters such as '#', '?' and '%' in a title don't change where the
+/// link points. Only letters, digits and "-._~" are left as they are, so
+/// the result needs no HTML escaping.
+string encodeUrlPath(const string& text) {
+    static const char hex[] = "0123456789ABCDEF";
+    string encoded;
+    encoded.reserve(text.length());
+
+    for (unsigned char c : text) {
+        if (isalnum(c) || c == '-' || c == '.' || c == '_' || c == '~') {
+            encoded += c;
+        } else {
+            encoded += '%';
+            encoded += hex[c >> 4];
+            encoded += hex[c & 15];
+        }
+    }
+
+    return encoded;
+}
+
+/// What the last 'export-html' to a directory knew about one note. Stored
+/// in that directory's manifest.
+///
+/// Attributes:
+/// - 'size', 'modified': The total size and latest modification time of the
+///   note's files, so an unchanged note doesn't have to be read again.
+/// - 'contentHash': Hash of the note's body.
+/// - 'pageHash': Hash of everything its page was rendered from: the content,
+///   its backlinks and which of its links led to existing notes.
+/// - 'links': The titles the note links to.
+struct ExportRecord {
+    uintmax_t size = 0;
+    long long modified = 0;
+    uint64_t contentHash = 0;
+    uint64_t pageHash = 0;
+    set<string> links;
+};
+
+const string exportManifestName = ".manifest"; // Manifest of an export.
+
+/// Reads the manifest of a previous export into <records>.
+///
+/// Args:
+/// - 'path': The manifest's path.
+/// - 'records': Filled with the record of every note in the manifest.
+void readExportManifest(const fs::path& path, map<string, ExportRecord>& records) {
+    ifstream infile(path);
+    string line;
+
+    while (getline(infile, line)) {
+        istringstream fields(line);
+        string title;
+        string links;
+        ExportRecord record;
+
+        getline(fields, title, '\t');
+        fields >> record.size >> record.modified >> record.contentHash >>
+            record.pageHash;
+        fields.ignore(1);
+        getline(fields, links);
+
+        istringstream linkList(links);
+        for (string link; getline(linkList, link, '|');) {
+            if (!link.empty()) record.links.insert(link);
+        }
+
+        if (fields || fields.eof()) records[title] = move(record);
+    }
+}
+
+/// Writes <records> as the manifest at <path>, replacing it atomically.
+void writeExportManifest(const fs::path& path,
+                         const map<string, ExportRecord>& records) {
+    const fs::path tempPath = path.string() + ".tmp";
+    ofstream outfile(tempPath);
+
+    for (const auto& [title, record] : records) {
+        outfile << title << '\t' << record.size << ' ' << record.modified << ' '
+                << record.contentHash << ' ' << record.pageHash << ' ';
+        for (const auto& link : record.links) outfile << link << '|';
+        outfile << '\n';
+    }
+
+    outfile.close();
+    fs::rename(tempPath, path);
+}
+
+/// Writes the HTML page of note <title>, reading the note a line at a time,
+/// whether it is plain, packed or log.
+///
+/// Args:
+/// - 'title': The name of the note.
+/// - 'outPath': Where the page is written.
+/// - 'backlinks': The notes that link to this one.
+/// - 'exists': Checks if a linked title is a saved note.
+void renderNotePage(const string& title, const fs::path& outPath,
+                    const vector<string>& backlinks,
+                    const function<bool(const string&)>& exists) {
+    ofstream outfile(outPath);
+    string timestamp;
+
+    const string head = noteHead(title);
+    const size_t sep = head.find(headSep);
+    if (sep != string::npos) timestamp = head.substr(sep + headSep.length());
+
+    outfile << "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>"
+            << escapeHtml(title) << "</title></head><body>\n"
+            << "<p><a href=\"index.html\">All notes</a></p>\n<h1>"
+            << escapeHtml(title) << "</h1>\n<p><small>" << escapeHtml(timestamp)
+            << "</small></p>\n";
+
+    forEachNoteLine(title, [&](const string& line) {
+        if (line.empty()) return;
+
+        size_t level = 0;
+        while (level < line.length() && line[level] == '#') level++;
+        const bool heading = level > 0 && level < line.length() &&
+                             line[level] == ' ';
+        const string tag = heading ? "h" + to_string(min<size_t>(level + 1, 6))
+                                   : "p";
+        const string text = heading ? line.substr(level + 1) : line;
+
+        // Turn [[title]] into links, leaving links to missing notes as text.
+        string html;
+        size_t pos = 0;
+        for (size_t open; (open = text.find("[[", pos)) != string::npos;) {
+            const size_t close = text.find("]]", open + 2);
+            if (close == string::npos) break;
+
+            const string target = text.substr(open + 2, close - open - 2);
+            html += escapeHtml(text.substr(pos, open - pos));
+            html += exists(target)
+                ? "<a href=\"" + encodeUrlPath(target) + ".html\">" +
+                  escapeHtml(target) + "</a>"
+                : escapeHtml(text.substr(open, close + 2 - open));
+            pos = close + 2;
+        }
+        html += escapeHtml(text.substr(pos));
+
+        outfile << "<" << tag << ">" << html << "</" << tag << ">\n";
+    });
+
+    if (!backlinks.empty()) {
+        outfile << "<h2>Linked from</h2>\n<ul>\n";
+        for (const auto& source : backlinks) {
+            outfile << "<li><a href=\"" << encodeUrlPath(source) << ".html\">"
+                    << escapeHtml(source) << "</a></li>\n";
+        }
+        outfile << "</ul>\n";
+    }
+
+    outfile << "</body></html>\n";
+}
+
+/// Renders every note to an HTML page in <outDir>, along with an index page.
+///
+/// A manifest in <outDir> remembers what each page was rendered from. Notes
+/// whose file size and modification time haven't changed aren't read, and
+/// only pages whose content, backlinks or link targets changed are written
+/// again. Reading and rendering are spread over a pool of threads.
+///
+/// Args:
+/// - 'outDir': The directory the site is written to.
+void exportHtml(const fs::path& outDir) {
+    error_code error;
+    fs::create_directories(outDir, error);
+    if (!fs::is_directory(outDir)) {
+        logger.log(LogLevel::Error, "export_dir_failed", {
+            {"path", outDir.string()}, {"error", error.message()}});
+        cout << "ERROR: Could not create '" << outDir.string() << "'.\n\n";
+        return;
+    }
+
+    ensureCatalog();
+    const fs::path manifestPath = outDir / exportManifestName;
+    map<string, ExportRecord> previous;
+    readExportManifest(manifestPath, previous);
+
+    // Notes are exported in every form; one whose files have gone since
+    // the catalog was read is left out.
+    vector<string> titles;
+    vector<vector<fs::path>> files;
+    catalog.forEach("", [&](const CatalogEntry& entry) {
+        auto found = noteFiles(entry.title);
+        if (!found.empty()) {
+            titles.push_back(entry.title);
+            files.push_back(move(found));
+        }
+        return true;
+    });
+
+    // Find each note's links, reading only the notes that changed.
+    vector<ExportRecord> records(titles.size());
+    runParallel(titles.size(), [&](size_t i) {
+        ExportRecord& record = records[i];
+        error_code statError;
+
+        for (const auto& file : files[i]) {
+            record.size += fs::file_size(saveDir / file, statError);
+            record.modified = max<long long>(record.modified,
+                fs::last_write_time(saveDir / file, statError).time_since_epoch().count());
+        }
+
+        const auto old = previous.find(titles[i]);
+        if (old != previous.end() && old->second.size == record.size &&
+            old->second.modified == record.modified) {
+            record.contentHash = old->second.contentHash;
+            record.pageHash = old->second.pageHash;
+            record.links = old->second.links;
+            return;
+        }
+
+        uint64_t hash = hashText(noteHead(titles[i]) + "\n");
+        forEachNoteLine(titles[i], [&](const string& line) {
+            hash = hashText(line + "\n", hash);
+            extractLinks(line, record.links);
+        });
+        record.contentHash = hash;
+    });
+
+    const auto exists = [&](const string& title) {
+        return binary_search(titles.begin(), titles.end(), title);
+    };
+
+    map<string, vector<string>> backlinks;
+    for (size_t i = 0; i < titles.size(); ++i) {
+        for (const auto& link : records[i].links) {
+            if (link != titles[i] && exists(link)) {
+                backlinks[link].push_back(titles[i]);
+            }
+        }
+    }
+
+    // Work out which pages are out of date.
+    vector<size_t> stale;
+    for (size_t i = 0; i < titles.size(); ++i) {
+        uint64_t hash = hashText(to_string(records[i].contentHash));
+        for (const auto& source : backlinks[titles[i]]) hash = hashText("<" + source, hash);
+        for (const auto& link : records[i].links) {
+            hash = hashText((exists(link) ? ">" : "!") + link, hash);
+        }
+
+        const auto old = previous.find(titles[i]);
+        const bool upToDate = old != previous.end() && old->second.pageHash == hash &&
+                              fs::exists(outDir / (titles[i] + ".html"));
+        records[i].pageHash = hash;
+        if (!upToDate) stale.push_back(i);
+    }
+
+    runParallel(stale.size(), [&](size_t i) {
+        static const vector<string> none;
+        const string& title = titles[stale[i]];
+        const auto sources = backlinks.find(title);
+        renderNotePage(title, outDir / (title + ".html"),
+                       sources == backlinks.end() ? none : sources->second,
+                       exists);
+    });
+
+    // Remove the pages of notes that are gone.
+    size_t removed = 0;
+    for (const auto& [title, record] : previous) {
+        if (!exists(title) && fs::remove(outDir / (title + ".html"), error)) {
+            removed++;
+        }
+    }
+
+    ofstream index(outDir / "index.html");
+    index << "<!DOCTYPE html>\n<html><head><meta charset=\"utf-8\"><title>"
+             "Notes</title></head><body>\n<h1>Notes</h1>\n<ul>\n";
+    for (const auto& title : titles) {
+        index << "<li><a href=\"" << encodeUrlPath(title) << ".html\">"
+              << escapeHtml(title) << "</a></li>\n";
+    }
+    index << "</ul>\n</body></html>\n";
+    index.close();
+
+    map<string, ExportRecord> manifest;
+    for (size_t i = 0; i < titles.size(); ++i) {
+        manifest[titles[i]] = move(records[i]);
+    }
+    writeExportManifest(manifestPath, manifest);
+
+    cout << "Exported " << titles.size() << " notes to '" << outDir.string()
+         << "' (" << stale.size() << " rendered, " << removed
+         << " removed).\n\n";
+}
+
+/// Removes the files of note <title>, whether plain, packed or log, its
+/// outline and its attachments. The indexes are left for the caller to
+/// update.
+///
+/// Returns false if there was no such note or it couldn't be removed.
+bool removeNoteFiles(const string& title, error_code& error) {
+    bool removed = fs::remove(saveDir / (title + noteExt), error) ||
+                   fs::remove(PackedNote::pathOf(title), error);
+    if (!removed) {
+        // remove_all returns -1, not 0, when it fails.
+        const uintmax_t count = fs::remove_all(LogNote::pathOf(title), error);
+        removed = !error && count > 0;
+    }
+
+    if (removed) {
+        fs::remove(Outline::pathOf(title), error);
+        fs::remove_all(attachmentsOf(title), error);
+        return true;
+    }
+    return false;
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+const size_t tarBlock = 512; // Tar streams are made of 512-byte blocks.
+
+/// Writes all <length> bytes of <data> to <fd>.
+///
+/// Returns false if the write failed.
+bool writeAll(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        const ssize_t written = write(fd, data, length);
+        if (written < 0 && errno == EINTR) continue;
+        if (written <= 0) return false;
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+/// Reads exactly <length> bytes from <fd> into <data>.
+///
+/// Returns false if the stream ended or failed first.
+bool readAll(int fd, char* data, size_t length) {
+    while (length > 0) {
+        const ssize_t got = read(fd, data, length);
+        if (got < 0 && errno == EINTR) continue;
+        if (got <= 0) return false;
+        data += got;
+        length -= got;
+    }
+    return true;
+}
+
+/// Copies <count> bytes from <inFd> to <outFd>. On Linux the bytes are
+/// moved inside the kernel with sendfile, or splice when reading from a
+/// pipe, and only fall back to a user-space buffer when neither applies.
+///
+/// Returns false if fewer than <count> bytes could be copied.
+bool copyBytes(int inFd, int outFd, uint64_t count) {
+#if defined(__linux__)
+    bool useSendfile = true;
+    bool useSplice = true;
+
+    while (count > 0 && (useSendfile || useSplice)) {
+        const size_t chunk = min<uint64_t>(count, 1 << 30);
+        ssize_t moved = useSendfile ? sendfile(outFd, inFd, nullptr, chunk)
+                                    : splice(inFd, nullptr, outFd, nullptr,
+                                             chunk, SPLICE_F_MOVE);
+
+        if (moved < 0 && errno == EINTR) continue;
+        if (moved < 0 && (errno == EINVAL || errno == ENOSYS)) {
+            (useSendfile ? useSendfile : useSplice) = false;
+            continue;
+        }
+        if (moved <= 0) return false;
+        count -= moved;
+    }
+#endif
+
+    vector<char> buffer(64 << 10);
+
+    while (count > 0) {
+        const size_t chunk = min<uint64_t>(count, buffer.size());
+        if (!readAll(inFd, buffer.data(), chunk) ||
+            !writeAll(outFd, buffer.data(), chunk)) {
+            return false;
+        }
+        count -= chunk;
+    }
+
+    return true;
+}
+
+/// Returns a pax extended header record 'LEN key=value\n', where LEN counts
+/// the whole record including itself.
+string paxRecord(const string& key, const string& value) {
+    const size_t base = key.length() + value.length() + 3;
+    size_t length = base + to_string(base).length();
+    if (to_string(length).length() != to_string(base).length()) length++;
+    return to_string(length) + " " + key + "=" + value + "\n";
+}
+
+/// Builds a ustar header block.
+///
+/// Args:
+/// - 'name': The entry's file name; cut to 100 characters.
+/// - 'size': The entry's size; must fit in 11 octal digits.
+/// - 'modified': The entry's modification time in seconds since the epoch.
+/// - 'type': The entry's type flag, '0' for a regular file.
+array<char, tarBlock> tarHeader(const string& name, uint64_t size,
+                                uint64_t modified, char type) {
+    array<char, tarBlock> header{};
+    const auto field = [&](size_t offset, size_t width, uint64_t value) {
+        snprintf(&header[offset], width, "%0*llo", static_cast<int>(width - 1),
+                 static_cast<unsigned long long>(value));
+    };
+
+    name.copy(&header[0], 100);
+    field(100, 8, 0644);
+    field(108, 8, 0);
+    field(116, 8, 0);
+    field(124, 12, size);
+    field(136, 12, modified);
+    header[156] = type;
+    memcpy(&header[257], "ustar", 6);
+    memcpy(&header[263], "00", 2);
+
+    // The checksum is taken with its own field filled with spaces.
+    memset(&header[148], ' ', 8);
+    unsigned checksum = 0;
+    for (char c : header) checksum += static_cast<unsigned char>(c);
+    snprintf(&header[148], 8, "%06o", checksum);
+    header[155] = ' ';
+
+    return header;
+}
+
+/// Writes the file at <path> to <outFd> as a tar entry called <name>, with a
+/// pax header first if the name or size doesn't fit a ustar header.
+///
+/// Returns false if the file couldn't be read or the stream written.
+///
+/// Args:
+/// - 'outFd': Where the tar stream is written.
+/// - 'name': The entry's name in the archive.
+/// - 'path': The file being archived.
+/// - 'modified': The entry's modification time in seconds since the epoch.
+bool writeTarEntry(int outFd, const string& name, const fs::path& path,
+                   uint64_t modified) {
+    const int inFd = open(path.c_str(), O_RDONLY);
+    struct stat info;
+    if (inFd < 0) return false;
+    if (fstat(inFd, &info) != 0) {
+        close(inFd);
+        return false;
+    }
+    const uint64_t size = info.st_size;
+
+    // Names over 100 characters and sizes over 8 GB need a pax header.
+    string pax;
+    if (name.length() > 100) pax += paxRecord("path", name);
+    if (size > 077777777777ULL) pax += paxRecord("size", to_string(size));
+    bool written = true;
+
+    if (!pax.empty()) {
+        const auto header = tarHeader("PaxHeader", pax.length(), modified, 'x');
+        pax.resize((pax.length() + tarBlock - 1) / tarBlock * tarBlock, '\0');
+        written = writeAll(outFd, header.data(), tarBlock) &&
+                  writeAll(outFd, pax.data(), pax.length());
+    }
+
+    const auto header = tarHeader(name, min<uint64_t>(size, 077777777777ULL),
+                                  modified, '0');
+    const array<char, tarBlock> padding{};
+    written = written && writeAll(outFd, header.data(), tarBlock) &&
+              copyBytes(inFd, outFd, size) &&
+              writeAll(outFd, padding.data(), (tarBlock - size % tarBlock) % tarBlock);
+    close(inFd);
+
+    if (written) metrics.bytesRead.fetch_add(size, memory_order_relaxed);
+    return written;
+}
+
+/// Writes every note to <outFd> as a POSIX tar stream, one entry per file
+/// of the note, so plain and packed notes are a single '.cppn' or '.cppnz'
+/// entry and log notes one entry per file of their directory. Each note
+/// is followed by the chunks and manifest of its attachments. The notes come from the catalog
+/// and bodies are copied with copyBytes, so memory use doesn't depend on
+/// the size of the store.
+///
+/// Returns the number of notes written, or -1 if writing failed.
+///
+/// Args:
+/// - 'outFd': Where the tar stream is written.
+long long exportTar(int outFd) {
+    ensureCatalog();
+    long long written = 0;
+    size_t skipped = 0;
+    bool failed = false;
+
+    catalog.forEach("", [&](const CatalogEntry& entry) {
+        auto files = noteFiles(entry.title);
+        const uint64_t modified = static_cast<uint64_t>(entry.created) * 60;
+
+        // The catalog may lag notes deleted outside the program.
+        if (files.empty()) {
+            skipped++;
+            return true;
+        }
+
+        const auto attached = attachmentFiles(entry.title);
+        files.insert(files.end(), attached.begin(), attached.end());
+        for (const auto& file : files) {
+            if (!writeTarEntry(outFd, file.generic_string(), saveDir / file, modified)) {
+                failed = true;
+                return false;
+            }
+        }
+
+        written++;
+        return true;
+    });
+
+    if (skipped > 0) {
+        logger.log(LogLevel::Warn, "export_skipped", {{"notes", to_string(skipped)}});
+    }
+
+    // A tar stream ends with two empty blocks.
+    const array<char, tarBlock * 2> end{};
+    if (failed || !writeAll(outFd, end.data(), end.size())) return -1;
+    return written;
+}
+
+/// Reads the notes in a tar stream from <inFd> into the save directory,
+/// replacing notes with the same titles. Entries that aren't files of a
+/// note or its attachments are skipped. Each file is copied with copyBytes
+/// into a temporary file that is renamed into place once complete; the
+/// first file of a note removes whatever was saved under its title before.
+/// Attachments are gathered in a hidden directory that only takes their
+/// name once their manifest, written last, has arrived.
+///
+/// Returns the number of notes read, or -1 if the stream was cut short or
+/// its headers are malformed.
+///
+/// Args:
+/// - 'inFd': Where the tar stream is read from.
+long long importTar(int inFd) {
+    long long imported = 0;
+    set<string> replaced;
+    array<char, tarBlock> header;
+    string paxPath;
+    uint64_t paxSize = 0;
+
+    // Reads a header's numeric field, octal or GNU base-256.
+    const auto number = [&](size_t offset, size_t width) {
+        uint64_t value = 0;
+        if (static_cast<unsigned char>(header[offset]) & 0x80) {
+            for (size_t i = 1; i < width; ++i) {
+                value = value << 8 | static_cast<unsigned char>(header[offset + i]);
+            }
+            return value;
+        }
+        for (size_t i = offset; i < offset + width && header[i]; ++i) {
+            if (header[i] >= '0' && header[i] <= '7') value = value * 8 + header[i] - '0';
+        }
+        return value;
+    };
+
+    const auto skip = [&](uint64_t count) {
+        const int devNull = open("/dev/null", O_WRONLY);
+        const bool done = copyBytes(inFd, devNull, count);
+        close(devNull);
+        return done;
+    };
+
+    while (readAll(inFd, header.data(), tarBlock)) {
+        if (all_of(header.begin(), header.end(), [](char c) { return c == 0; })) {
+            reloadIndexes();
+            return imported;
+        }
+
+        const char type = header[156];
+        uint64_t size = paxSize ? paxSize : number(124, 12);
+        if (size > UINT64_MAX - tarBlock) break;
+        const uint64_t padded = (size + tarBlock - 1) / tarBlock * tarBlock;
+        string name = paxPath.empty()
+            ? string(&header[0], strnlen(&header[0], 100)) : paxPath;
+        if (paxPath.empty() && memcmp(&header[257], "ustar", 5) == 0 && header[345]) {
+            name = string(&header[345], strnlen(&header[345], 155)) + "/" + name;
+        }
+        paxPath.clear();
+        paxSize = 0;
+
+        // Extended headers only hold a path and a size, so a big one is
+        // not a real archive.
+        if (type == 'x') {
+            if (size > maxPaxHeaderSize) break;
+            string records(padded, '\0');
+            if (!readAll(inFd, &records[0], padded)) break;
+            records.resize(size);
+
+            istringstream stream(records);
+            for (string record; getline(stream, record);) {
+                const size_t space = record.find(' ');
+                const size_t equals = record.find('=');
+                if (space == string::npos || equals == string::npos) continue;
+                const string key = record.substr(space + 1, equals - space - 1);
+                if (key == "path") paxPath = record.substr(equals + 1);
+                if (key != "size") continue;
+
+                const string value = record.substr(equals + 1);
+                char* end = nullptr;
+                errno = 0;
+                paxSize = strtoull(value.c_str(), &end, 10);
+                if (value.empty() || !isdigit(static_cast<unsigned char>(value[0])) ||
+                    errno == ERANGE || *end != '\0') {
+                    paxSize = UINT64_MAX;
+                }
+            }
+            if (paxSize == UINT64_MAX) break;
+            continue;
+        }
+
+        // Notes may come from a plain 'tar' of the save directory, so only
+        // the last parts of the name are used: a note's file, a log note's
+        // directory and one of its files, or an attachment's directory and
+        // one of its files.
+        const fs::path path(name);
+        const fs::path last = path.filename();
+        const fs::path parent = path.parent_path().filename();
+        const fs::path grandparent = path.parent_path().parent_path().filename();
+        fs::path file;
+        fs::path attachment;
+        string title;
+        bool startsNote = false;
+
+        if (last.extension() == noteExt || last.extension() == packedExt) {
+            file = last;
+            title = last.stem().string();
+            startsNote = true;
+        } else if (parent.extension() == logExt) {
+            file = parent / last;
+            title = parent.stem().string();
+            startsNote = last == "index";
+        } else if (grandparent.extension() == attachmentExt) {
+            title = grandparent.stem().string();
+            attachment = grandparent / parent;
+            file = grandparent / ("." + parent.string() + ".part") / last;
+        }
+
+        const string attachmentName = parent.string();
+        if ((type != '0' && type != '\0') || file.empty() || title.empty() ||
+            !validateInput(title) || last == "." || last == ".." ||
+            !validateInput(last.string()) ||
+            (!attachment.empty() && (attachmentName.empty() || attachmentName[0] == '.' ||
+                                     !validateInput(attachmentName)))) {
+            if (!skip(padded)) break;
+            continue;
+        }
+
+        const fs::path tempPath = saveDir / "import.part";
+        const int outFd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        const bool copied = outFd >= 0 && copyBytes(inFd, outFd, size);
+        if (outFd >= 0) close(outFd);
+        if (copied) metrics.bytesWritten.fetch_add(size, memory_order_relaxed);
+
+        if (!copied || !skip(padded - size)) {
+            fs::remove(tempPath);
+            break;
+        }
+
+        error_code error;
+        if (replaced.insert(title).second) removeNoteFiles(title, error);
+        fs::create_directories((saveDir / file).parent_path(), error);
+        fs::rename(tempPath, saveDir / file, error);
+        imported += startsNote;
+
+        if (!attachment.empty() && last == "manifest") {
+            fs::remove_all(saveDir / attachment, error);
+            fs::rename((saveDir / file).parent_path(), saveDir / attachment, error);
+        }
+    }
+
+    reloadIndexes();
+    return -1;
+}
+
+#endif
+
+/// Finishes or abandons a 'replace' that was cut short. If its journal was
+/// written, the batch was committed, so every staged note still left is
+/// moved into place; otherwise the staged notes are thrown away.
+void finishReplace() {
+    error_code error;
+
+    if (fs::exists(replaceJournal, error)) {
+        ifstream journal(replaceJournal);
+        string title;
+        size_t moved = 0;
+
+        while (getline(journal, title)) {
+            const fs::path staged = replaceStaging / (title + noteExt);
+            if (!fs::exists(staged, error)) continue;
+            fs::rename(staged, saveDir / (title + noteExt), error);
+            moved += !error;
+        }
+
+        syncFile(saveDir);
+        logger.log(LogLevel::Info, "replace_finished", {{"notes", to_string(moved)}});
+    }
+
+    fs::remove(replaceJournal, error);
+    fs::remove_all(replaceStaging, error);
+}
+
+/// Splits <text> into words at spaces, keeping a phrase in double quotes
+/// together as one word.
+///
+/// Returns false, after printing why, if a quote isn't closed.
+bool splitQuoted(const string& text, vector<string>& words) {
+    size_t i = 0;
+
+    while (i < text.length()) {
+        if (isspace(static_cast<unsigned char>(text[i]))) {
+            i++;
+        } else if (text[i] == '"') {
+            const size_t close = text.find('"', i + 1);
+            if (close == string::npos) {
+                cout << "ERROR: Missing closing quote.\n\n";
+                return false;
+            }
+            words.push_back(text.substr(i + 1, close - i - 1));
+            i = close + 1;
+        } else {
+            size_t end = i;
+            while (end < text.length() && !isspace(static_cast<unsigned char>(text[end]))) {
+                end++;
+            }
+            words.push_back(text.substr(i, end - i));
+            i = end;
+        }
+    }
+
+    return true;
+}
+
+/// Counts the matches of <pattern> in the body of the note at <filePath>,
+/// reading it 'streamChunkSize' bytes at a time. The last pattern.size() - 1
+/// bytes of each chunk are carried into the next, so a match cut by the
+/// edge of a chunk is still found. If <out> is given the note is copied to
+/// it, head included, with every match replaced by <replacement>.
+///
+/// Returns the number of matches.
+size_t replaceInNote(const fs::path& filePath, const string& pattern,
+                     const string& replacement, ostream* out) {
+    ifstream infile(filePath, ios::binary);
+    string head;
+    string blank;
+    if (!getline(infile, head) || !getline(infile, blank)) return 0;
+    if (out) *out << head << '\n' << blank << '\n';
+
+    string buffer(streamChunkSize, '\0');
+    string window;
+    size_t matches = 0;
+
+    for (bool more = true; more;) {
+        more = static_cast<bool>(infile.read(&buffer[0], buffer.size()));
+        window.append(buffer, 0, infile.gcount());
+        metrics.bytesRead.fetch_add(infile.gcount(), memory_order_relaxed);
+
+        // Matches must start before <limit>; one starting later may run on
+        // into the next chunk. find() looks for the pattern's first byte
+        // with memchr, which scans a word at a time.
+        const size_t limit = window.size() - (more ? min(window.size(), pattern.size() - 1) : 0);
+        size_t copied = 0;
+        for (size_t at = window.find(pattern); at != string::npos && at < limit;
+             at = window.find(pattern, at + pattern.size())) {
+            matches++;
+            if (out) out->write(window.data() + copied, at - copied) << replacement;
+            copied = at + pattern.size();
+        }
+
+        const size_t done = max(copied, limit);
+        if (out) out->write(window.data() + copied, done - copied);
+        window.erase(0, done);
+    }
+
+    return matches;
+}
+
+/// Replaces <pattern> with <replacement> in the body of every plain note,
+/// for 'replace [--preview] <pattern> <replacement>'.
+///
+/// Notes are searched in parallel, a chunk at a time so memory use doesn't
+/// depend on their size, and each note with a match is streamed again into
+/// 'replaceStaging' by the task that searched it. Once every note is staged
+/// they are flushed to disk together. Then, under the store's write lock,
+/// every note is checked to be unchanged since it was read and a journal
+/// naming them is written; that journal is the commit point. The staged
+/// notes are then renamed over the old ones. If the program stops partway,
+/// 'finishReplace' completes the batch or drops it on the next start, so
+/// either every note changes or none do.
+///
+/// Args:
+/// - 'arg': The pattern and the replacement, after '--preview' to only list
+///   how many matches each note has.
+void replaceText(const string& arg) {
+    vector<string> words;
+    if (!splitQuoted(arg, words)) return;
+
+    const bool preview = !words.empty() && words[0] == "--preview";
+    if (preview) words.erase(words.begin());
+
+    if (words.size() != 2 || words[0].empty()) {
+        cout << "ERROR: Use 'replace [--preview] [pattern] [replacement]'; quote "
+                "text with spaces.\n\n";
+        return;
+    }
+
+    const string& pattern = words[0];
+    const string& replacement = words[1];
+
+    vector<string> titles;
+    size_t skipped = 0;
+    if (fs::is_directory(saveDir)) {
+        for (const auto& entry : fs::directory_iterator(saveDir)) {
+            if (!isNoteEntry(entry)) continue;
+            if (entry.path().extension() == noteExt) {
+                titles.push_back(entry.path().stem().string());
+            } else {
+                skipped++;
+            }
+        }
+    }
+    sort(titles.begin(), titles.end());
+
+    error_code error;
+    if (!preview) {
+        fs::remove_all(replaceStaging, error);
+        fs::create_directories(replaceStaging, error);
+    }
+
+    vector<size_t> matches(titles.size(), 0);
+    vector<fs::file_time_type> modified(titles.size());
+    atomic<bool> failed{false};
+
+    runParallel(titles.size(), [&](size_t i) {
+        const fs::path filePath = saveDir / (titles[i] + noteExt);
+        error_code statError;
+        modified[i] = fs::last_write_time(filePath, statError);
+
+        // Only the body is searched, never the head.
+        matches[i] = replaceInNote(filePath, pattern, replacement, nullptr);
+        if (preview || matches[i] == 0) return;
+
+        const fs::path stagedPath = replaceStaging / (titles[i] + noteExt);
+        ofstream outfile(stagedPath, ios::binary);
+        if (replaceInNote(filePath, pattern, replacement, &outfile) != matches[i]) {
+            failed = true;
+        }
+        outfile.close();
+        if (outfile.fail()) failed = true;
+        metrics.bytesWritten.fetch_add(fs::file_size(stagedPath, statError),
+                                       memory_order_relaxed);
+    });
+
+    size_t total = 0;
+    vector<string> changed;
+    for (size_t i = 0; i < titles.size(); ++i) {
+        if (matches[i] == 0) continue;
+        total += matches[i];
+        changed.push_back(titles[i]);
+        if (preview) cout << "> " << titles[i] << " (" << matches[i] << ")\n";
+    }
+
+    if (changed.empty()) {
+        if (!preview) fs::remove_all(replaceStaging, error);
+        cout << "No notes contain '" << pattern << "'.\n\n";
+        return;
+    }
+
+    const string summary = to_string(total) + " matches in " +
+                           to_string(changed.size()) + " notes";
+    const string skippedNote = skipped == 0 ? "" :
+        " (" + to_string(skipped) + " log or packed notes left alone)";
+
+    if (preview) {
+        cout << summary << skippedNote << ".\n\n";
+        return;
+    }
+
+    if (failed) {
+        fs::remove_all(replaceStaging, error);
+        logger.log(LogLevel::Error, "replace_failed", {{"pattern", pattern}});
+        cout << "ERROR: The rewritten notes could not be written; nothing was "
+                "changed.\n\n";
+        return;
+    }
+
+    // Make every staged note durable with one flush, then commit the batch
+    // by writing its journal.
+    vector<fs::path> staged;
+    for (const auto& title : changed) staged.push_back(replaceStaging / (title + noteExt));
+    syncStore(staged);
+
+    // Commit under the write lock, and only if no note was written since
+    // it was read, so an edit made meanwhile by another process isn't lost.
+    sharedCatalog.lock();
+    for (size_t i = 0; i < titles.size(); ++i) {
+        if (matches[i] == 0) continue;
+        if (fs::last_write_time(saveDir / (titles[i] + noteExt), error) != modified[i] ||
+            error) {
+            sharedCatalog.unlock();
+            fs::remove_all(replaceStaging, error);
+            logger.log(LogLevel::Warn, "replace_conflict", {
+                {"pattern", pattern}, {"note", titles[i]}});
+            cout << "ERROR: " << titles[i] << " changed while it was being "
+                    "rewritten; nothing was changed.\n\n";
+            return;
+        }
+    }
+
+    const fs::path journalTemp = replaceJournal.string() + ".tmp";
+    ofstream journal(journalTemp);
+    for (const auto& title : changed) journal << title << "\n";
+    journal.close();
+    syncFile(journalTemp);
+    fs::rename(journalTemp, replaceJournal, error);
+    if (journal.fail() || error) {
+        sharedCatalog.unlock();
+        fs::remove(journalTemp, error);
+        fs::remove_all(replaceStaging, error);
+        logger.log(LogLevel::Error, "replace_failed", {{"pattern", pattern}});
+        cout << "ERROR: The change could not be committed; nothing was changed.\n\n";
+        return;
+    }
+    syncFile(saveDir);
+
+    finishReplace();
+    sharedCatalog.unlock();
+    reloadIndexes();
+
+    logger.log(LogLevel::Info, "replace_committed", {
+        {"pattern", pattern}, {"notes", to_string(changed.size())},
+        {"matches", to_string(total)}});
+    cout << "Replaced " << summary << skippedNote << ".\n\n";
+}
+
+/// A sorted run of lines in a file, read one line at a time while runs are
+/// merged.
+///
+/// Attributes:
+/// - 'line': The run's current line.
+struct SortRun {
+    vector<char> buffer;
+    ifstream infile;
+    string line;
+
+    explicit SortRun(const fs::path& runPath) : buffer(sortBufferSize) {
+        infile.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+        infile.open(runPath, ios::binary);
+    }
+
+    bool next() { return static_cast<bool>(getline(infile, line)); }
+};
+
+/// Merges the sorted run files <runs> into <out> with a heap holding the
+/// current line of each run.
+///
+/// Returns the number of lines written.
+///
+/// Args:
+/// - 'runs': The run files, each sorted.
+/// - 'out': Where the merged lines are written.
+/// - 'unique': Whether to write each distinct line only once.
+uint64_t mergeRuns(const vector<fs::path>& runs, ostream& out, bool unique) {
+    vector<unique_ptr<SortRun>> readers;
+    vector<size_t> heap;
+    const auto later = [&](size_t a, size_t b) {
+        return readers[a]->line != readers[b]->line ? readers[a]->line > readers[b]->line
+                                                    : a > b;
+    };
+
+    for (const auto& runPath : runs) {
+        readers.push_back(make_unique<SortRun>(runPath));
+        if (readers.back()->next()) heap.push_back(readers.size() - 1);
+    }
+    make_heap(heap.begin(), heap.end(), later);
+
+    uint64_t written = 0;
+    string last;
+
+    while (!heap.empty()) {
+        pop_heap(heap.begin(), heap.end(), later);
+        const size_t i = heap.back();
+        heap.pop_back();
+
+        if (!unique || written == 0 || readers[i]->line != last) {
+            out << readers[i]->line << '\n';
+            written++;
+            if (unique) last = readers[i]->line;
+        }
+
+        if (readers[i]->next()) {
+            heap.push_back(i);
+            push_heap(heap.begin(), heap.end(), later);
+        }
+    }
+
+    return written;
+}
+
+/// Sorts the lines of the body of note <title> in byte order, for 'sort'
+/// and 'uniq', keeping the head.
+///
+/// Notes whose lines fit in 'sortMemoryLimit' are sorted in memory. Bigger
+/// ones are read in pieces of that size, each sorted and written as a run
+/// file in the system's temporary directory. The runs are then merged,
+/// 'sortFanIn' at a time, until one pass writes the note. Either way the
+/// sorted note replaces the old one with a rename once it's complete.
+///
+/// Args:
+/// - 'title': The name of the note.
+/// - 'unique': Whether to keep only one copy of each line.
+void sortNote(const string& title, bool unique) {
+    const string command = unique ? "uniq" : "sort";
+    PackedNote packed;
+    const bool isPacked = PackedNote::exists(title) && packed.load(title);
+
+    if (!noteExists(title)) {
+        cout << "ERROR: '" << title << "' does not exist.\n";
+        suggestTitles(title);
+        cout << "\n";
+        return;
+    } else if (LogNote::exists(title)) {
+        cout << "ERROR: '" << title << "' is a log note; its lines stay in the "
+                "order they were written.\n\n";
+        return;
+    }
+
+    string head;
+    if (isPacked) {
+        head = packed.head();
+    } else {
+        ifstream infile(saveDir / (title + noteExt));
+        getline(infile, head);
+    }
+
+    error_code error;
+    const fs::path runDir = fs::temp_directory_path(error) /
+        ("cppnotes-sort-" + to_string(chrono::steady_clock::now().time_since_epoch().count()));
+    vector<fs::path> runs;
+    vector<string> lines;
+    size_t held = 0;
+    uint64_t total = 0;
+    bool failed = false;
+
+    const auto sortLines = [&] {
+        sort(lines.begin(), lines.end());
+        if (unique) lines.erase(std::unique(lines.begin(), lines.end()), lines.end());
+    };
+
+    // Writes the lines held so far as one sorted run.
+    const auto spill = [&] {
+        if (runs.empty()) fs::create_directories(runDir, error);
+        sortLines();
+
+        runs.push_back(runDir / ("run-" + to_string(runs.size())));
+        vector<char> buffer(sortBufferSize);
+        ofstream outfile;
+        outfile.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+        outfile.open(runs.back(), ios::binary);
+        for (const auto& line : lines) outfile << line << '\n';
+        outfile.close();
+        failed |= outfile.fail();
+
+        lines.clear();
+        lines.shrink_to_fit();
+        held = 0;
+    };
+
+    string carry;
+    streamNote(title, [&](const string& chunk) {
+        size_t pos = 0;
+        for (size_t lineEnd; (lineEnd = chunk.find('\n', pos)) != string::npos;
+             pos = lineEnd + 1) {
+            carry.append(chunk, pos, lineEnd - pos);
+            held += carry.size() + sizeof(string);
+            lines.push_back(move(carry));
+            carry.clear();
+            total++;
+            if (held >= sortMemoryLimit) spill();
+        }
+        carry.append(chunk, pos, string::npos);
+    });
+    if (!carry.empty()) {
+        lines.push_back(move(carry));
+        total++;
+    }
+
+    const bool external = !runs.empty();
+    if (external && !lines.empty()) spill();
+    const size_t spilled = runs.size();
+
+    // Merge runs a batch at a time until one pass can write the note.
+    while (runs.size() > sortFanIn && !failed) {
+        vector<fs::path> merged;
+        for (size_t first = 0; first < runs.size(); first += sortFanIn) {
+            const vector<fs::path> batch(runs.begin() + first,
+                                         runs.begin() + min(runs.size(), first + sortFanIn));
+            merged.push_back(runDir / ("run-" + to_string(runs.size() + merged.size())));
+            ofstream outfile(merged.back(), ios::binary);
+            mergeRuns(batch, outfile, unique);
+            outfile.close();
+            failed |= outfile.fail();
+            for (const auto& runPath : batch) fs::remove(runPath, error);
+        }
+        runs = move(merged);
+    }
+
+    const fs::path filePath = saveDir / (title + noteExt);
+    const fs::path tempPath = filePath.string() + ".tmp";
+    vector<char> buffer(sortBufferSize);
+    ofstream outfile;
+    outfile.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+    outfile.open(tempPath, ios::binary);
+    outfile << head << "\n\n";
+
+    uint64_t kept = 0;
+    string body;
+    if (external) {
+        kept = mergeRuns(runs, outfile, unique);
+    } else {
+        sortLines();
+        for (const auto& line : lines) body.append(line).push_back('\n');
+        outfile << body;
+        kept = lines.size();
+    }
+    outfile.close();
+    failed |= outfile.fail();
+    fs::remove_all(runDir, error);
+
+    if (failed) {
+        fs::remove(tempPath, error);
+        logger.log(LogLevel::Error, "sort_failed", {{"note", title}, {"command", command}});
+        cout << "ERROR: '" << title << "' could not be sorted; it was left as it "
+                "was.\n\n";
+        return;
+    }
+
+    metrics.bytesWritten.fetch_add(fs::file_size(tempPath, error), memory_order_relaxed);
+    syncFile(tempPath);
+    fs::rename(tempPath, filePath, error);
+    if (error) {
+        fs::remove(tempPath, error);
+        logger.log(LogLevel::Error, "sort_failed", {{"note", title}, {"command", command}});
+        cout << "ERROR: '" << title << "' could not be sorted; it was left as it "
+                "was.\n\n";
+        return;
+    }
+
+    // The note must be left in one form, since a packed note hides a plain
+    // one: repacked, or else plain with the old packed file removed.
+    if (isPacked && !PackedNote::pack(title)) {
+        fs::remove(PackedNote::pathOf(title), error);
+        if (error) {
+            fs::remove(filePath, error);
+            logger.log(LogLevel::Error, "sort_failed", {{"note", title}, {"command", command}});
+            cout << "ERROR: '" << title << "' could not be packed again; it was "
+                    "left as it was.\n\n";
+            return;
+        }
+        logger.log(LogLevel::Warn, "pack_failed", {{"note", title}, {"command", command}});
+        cout << "'" << title << "' could not be packed again, so it was kept "
+                "unpacked.\n";
+    }
+
+    // A note too big to hold has its indexes rebuilt from disk on next use.
+    if (external) {
+        reloadIndexes();
+    } else {
+        const size_t sep = head.find(headSep);
+        indexNote(Note(title, sep == string::npos ? "" : head.substr(sep + headSep.length()),
+                       head + "\n\n" + body));
+    }
+
+    logger.log(LogLevel::Info, "note_sorted", {
+        {"note", title}, {"command", command}, {"lines", to_string(total)},
+        {"kept", to_string(kept)}, {"runs", to_string(spilled)}});
+    cout << title << ": " << total << " lines sorted";
+    if (unique) cout << ", " << kept << " kept";
+    if (external) cout << " (merged from " << spilled << " runs on disk)";
+    cout << ".\n\n";
+}
+
+/// When notes are due to expire, kept in a hierarchical timer wheel with a
+/// tick of one second.
+///
+/// Each of the 'levels' wheels has 64 slots, and a slot of level L covers
+/// 64^L seconds, so five levels reach about 34 years. A timer goes into the
+/// level whose span holds its time left, in the slot picked by its due
+/// time, which makes adding one O(1). Each tick empties one slot of level
+/// 0; whenever the seconds roll over into a new slot of a higher level,
+/// that slot is moved down a level first. Every timer is moved at most
+/// once per level, so each tick does O(1) work on top of the notes that
+/// expire.
+///
+/// Cancelling only forgets the deadline; the timer is skipped when its slot
+/// comes up.
+///
+/// Attributes:
+/// - 'deadlines': When each note expires, in seconds since the epoch.
+/// - 'now': The next second to tick; everything due before it has fired.
+class ExpiryWheel {
+    private:
+        static constexpr unsigned levels = 5;
+        static constexpr unsigned slotBits = 6;
+        static constexpr uint64_t slotMask = (1 << slotBits) - 1;
+
+        struct Timer {
+            uint64_t due;
+            string title;
+        };
+
+        array<array<vector<Timer>, slotMask + 1>, levels> wheels;
+        unordered_map<string, uint64_t> deadlines;
+        uint64_t now = 0;
+
+        /// Puts <timer> in the slot for its time left. Timers already due go
+        /// into the slot ticked next.
+        void place(Timer timer) {
+            const uint64_t due = max(timer.due, now);
+            const uint64_t left = due - now;
+            unsigned level = 0;
+            while (level + 1 < levels && left >> (slotBits * (level + 1)) != 0) level++;
+
+            wheels[level][(due >> (slotBits * level)) & slotMask].push_back(move(timer));
+        }
+
+    public:
+        /// Sets the wheel's clock to <seconds>; call once before adding.
+        void start(uint64_t seconds) { now = seconds; }
+
+        /// Makes note <title> expire at <due>, replacing any earlier time.
+        void set(const string& title, uint64_t due) {
+            deadlines[title] = due;
+            place({due, title});
+        }
+
+        void cancel(const string& title) { deadlines.erase(title); }
+
+        /// Returns when note <title> expires, if it does.
+        optional<uint64_t> deadline(const string& title) const {
+            const auto found = deadlines.find(title);
+            if (found == deadlines.end()) return nullopt;
+            return found->second;
+        }
+
+        const unordered_map<string, uint64_t>& all() const { return deadlines; }
+
+        /// Ticks up to and including second <until>, adding the notes that
+        /// expired to <expired>.
+        void advance(uint64_t until, vector<string>& expired) {
+            for (; now <= until; ++now) {
+                // Move down the higher slots that start at this second,
+                // highest first so a timer can drop several levels at once.
+                for (unsigned level = levels - 1; level > 0; --level) {
+                    if ((now & ((uint64_t(1) << (slotBits * level)) - 1)) != 0) continue;
+
+                    auto& slot = wheels[level][(now >> (slotBits * level)) & slotMask];
+                    vector<Timer> moving = move(slot);
+                    slot.clear();
+                    for (auto& timer : moving) place(move(timer));
+                }
+
+                auto& slot = wheels[0][now & slotMask];
+                vector<Timer> firing = move(slot);
+                slot.clear();
+
+                for (auto& timer : firing) {
+                    const auto found = deadlines.find(timer.title);
+                    if (found == deadlines.end() || found->second != timer.due) continue;
+
+                    // Past the last level's reach; go round again.
+                    if (timer.due > now) {
+                        place(move(timer));
+                        continue;
+                    }
+
+                    deadlines.erase(found);
+                    expired.push_back(move(timer.title));
+                }
+            }
+        }
+};
+
+ExpiryWheel expiryWheel; // When notes with a TTL expire.
+size_t expiryRecords = 0; // Records in 'expiryJournal', live or not.
+pair<uintmax_t, fs::file_time_type> expiryJournalRead; // Stamp of the journal last read.
+
+/// When one note expires, as recorded in 'expiryJournal'.
+///
+/// Attributes:
+/// - 'due': When the note expires, in seconds since the epoch.
+/// - 'created': When the note the TTL was set on was created, from its
+///   head, so a note deleted and made again under the same name doesn't
+///   inherit the old note's expiry.
+struct Expiry {
+    uint64_t due = 0;
+    uint32_t created = 0;
+};
+
+/// Returns the current time in seconds since the epoch.
+uint64_t epochSeconds() {
+    return chrono::duration_cast<chrono::seconds>(
+        chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/// Adds a record to <out> that note <title> expires at <due>, or no longer
+/// expires if <due> is 0. Records are a varint due time, a varint creation
+/// time, a varint title length and the title.
+void appendExpiryRecord(vector<char>& out, const string& title, const Expiry& expiry) {
+    appendVarint(out, expiry.due);
+    appendVarint(out, expiry.created);
+    appendVarint(out, title.size());
+    out.insert(out.end(), title.begin(), title.end());
+}
+
+/// Returns the size and modification time of 'expiryJournal', which change
+/// whenever any process writes to it.
+pair<uintmax_t, fs::file_time_type> expiryJournalStamp() {
+    error_code error;
+    const uintmax_t size = fs::file_size(expiryJournal, error);
+    const auto modified = fs::last_write_time(expiryJournal, error);
+    return {error ? 0 : size, error ? fs::file_time_type() : modified};
+}
+
+/// Reads 'expiryJournal' into <expiries>, later records replacing earlier
+/// ones. A torn record at the end, from a write cut short, is ignored.
+///
+/// Returns the number of records read.
+size_t readExpiryJournal(unordered_map<string, Expiry>& expiries) {
+    ifstream infile(expiryJournal, ios::binary);
+    const string bytes((istreambuf_iterator<char>(infile)), istreambuf_iterator<char>());
+    const char* end = bytes.data() + bytes.size();
+    size_t records = 0;
+
+    for (const char* pos = bytes.data(); pos < end; records++) {
+        uint64_t due = 0;
+        uint64_t created = 0;
+        uint64_t length = 0;
+        if (!readVarint(pos, end, due) || !readVarint(pos, end, created) ||
+            !readVarint(pos, end, length) || length > static_cast<size_t>(end - pos)) {
+            break;
+        }
+
+        const string title(pos, length);
+        pos += length;
+        if (due == 0) {
+            expiries.erase(title);
+        } else {
+            expiries[title] = {due, static_cast<uint32_t>(created)};
+        }
+    }
+
+    return records;
+}
+
+/// Rewrites 'expiryJournal' with one record per note that still expires.
+/// The journal is read again first, under the store's write lock, so
+/// times set by other processes are kept.
+void compactExpiryJournal() {
+    sharedCatalog.lock();
+    unordered_map<string, Expiry> expiries;
+    readExpiryJournal(expiries);
+
+    vector<char> bytes;
+    for (const auto& [title, expiry] : expiries) appendExpiryRecord(bytes, title, expiry);
+
+    const fs::path tempPath = expiryJournal.string() + ".tmp";
+    ofstream(tempPath, ios::binary).write(bytes.data(), bytes.size());
+    syncFile(tempPath);
+    error_code error;
+    fs::rename(tempPath, expiryJournal, error);
+    sharedCatalog.unlock();
+
+    expiryRecords = expiries.size();
+}
+
+/// Appends <bytes> to 'expiryJournal'. The caller must hold the store's
+/// write lock.
+void appendExpiryJournal(const vector<char>& bytes) {
+    ofstream(expiryJournal, ios::binary | ios::app).write(bytes.data(), bytes.size());
+    syncFile(expiryJournal);
+}
+
+/// Appends <bytes>, holding <records> records, to 'expiryJournal', and
+/// compacts it once most of it is out of date.
+void writeExpiryRecords(const vector<char>& bytes, size_t records) {
+    sharedCatalog.lock();
+    appendExpiryJournal(bytes);
+    sharedCatalog.unlock();
+
+    expiryRecords += records;
+    if (expiryRecords > 2 * expiryWheel.all().size() + 1024) compactExpiryJournal();
+}
+
+/// Loads the expiry times saved in 'expiryJournal' into a fresh wheel.
+void loadExpiries() {
+    // Stamped before reading, so a write made during the read is picked
+    // up by the next syncExpiries.
+    expiryJournalRead = expiryJournalStamp();
+    unordered_map<string, Expiry> expiries;
+    expiryRecords = readExpiryJournal(expiries);
+
+    expiryWheel = ExpiryWheel();
+    expiryWheel.start(epochSeconds());
+    for (const auto& [title, expiry] : expiries) expiryWheel.set(title, expiry.due);
+}
+
+/// Reloads the wheel if 'expiryJournal' has been written since it was last
+/// read, so times set or cleared by other processes are seen.
+void syncExpiries() {
+    if (expiryJournalStamp() != expiryJournalRead) loadExpiries();
+}
+
+/// Makes note <title> expire <seconds> from now.
+void setExpiry(const string& title, uint64_t seconds) {
+    const Expiry expiry = {epochSeconds() + seconds, noteCreated(title)};
+    vector<char> bytes;
+    appendExpiryRecord(bytes, title, expiry);
+    expiryWheel.set(title, expiry.due);
+    writeExpiryRecords(bytes, 1);
+}
+
+/// Stops note <title> from expiring, if it was going to.
+void clearExpiry(const string& title) {
+    if (!expiryWheel.deadline(title)) return;
+
+    vector<char> bytes;
+    appendExpiryRecord(bytes, title, Expiry());
+    expiryWheel.cancel(title);
+    writeExpiryRecords(bytes, 1);
+}
+
+/// Deletes every note whose time is up, as one batch: the files are
+/// removed, the indexes updated and the journal written once for all of
+/// them.
+///
+/// The wheel may be behind other processes, so under the store's write
+/// lock the journal is read again and a note is only deleted if it still
+/// has a TTL that is up and is the same note the TTL was set on.
+void expireNotes() {
+    syncExpiries();
+    const uint64_t now = epochSeconds();
+    vector<string> due;
+    expiryWheel.advance(now, due);
+    if (due.empty()) return;
+
+    sharedCatalog.lock();
+    unordered_map<string, Expiry> current;
+    readExpiryJournal(current);
+
+    vector<string> expired;
+    vector<char> bytes;
+    size_t records = 0;
+    for (const auto& title : due) {
+        const auto found = current.find(title);
+        if (found == current.end()) continue;
+        if (found->second.due > now) {
+            expiryWheel.set(title, found->second.due);
+            continue;
+        }
+
+        // A TTL left behind by a note since deleted and made again is
+        // dropped without touching the new note.
+        error_code error;
+        if (noteExists(title) && noteCreated(title) == found->second.created &&
+            removeNoteFiles(title, error)) {
+            expired.push_back(title);
+        }
+        appendExpiryRecord(bytes, title, Expiry());
+        records++;
+    }
+
+    if (records > 0) appendExpiryJournal(bytes);
+    sharedCatalog.unlock();
+
+    expiryRecords += records;
+    if (expired.empty()) return;
+
+    unindexNotes(expired);
+    syncFile(saveDir);
+    logger.log(LogLevel::Info, "notes_expired", {{"notes", to_string(expired.size())}});
+}
+
+/// Reads a duration such as '90s', '30m', '12h', '7d' or '2w', of at most
+/// 'maxTtl' seconds.
+///
+/// Returns false if <text> isn't one.
+bool parseDuration(const string& text, uint64_t& seconds) {
+    if (text.empty() || !isdigit(static_cast<unsigned char>(text[0]))) return false;
+
+    char* end = nullptr;
+    errno = 0;
+    const unsigned long long count = strtoull(text.c_str(), &end, 10);
+    if (errno == ERANGE || count == 0 || strlen(end) != 1) return false;
+
+    const string units = "smhdw";
+    const array<uint64_t, 5> scale = {1, 60, 3600, 86400, 604800};
+    const size_t unit = units.find(*end);
+    if (unit == string::npos || count > maxTtl / scale[unit]) return false;
+
+    seconds = count * scale[unit];
+    return true;
+}
+
+/// Shows or changes when note <title> expires, for 'ttl <note> [duration]'.
+///
+/// Args:
+/// - 'arg': The note's name, then a duration such as '7d', or 'off' to
+///   keep the note. With no duration the current expiry is shown.
+void noteTtl(const string& arg) {
+    istringstream words(arg);
+    string title, duration;
+    words >> title >> duration;
+    uint64_t seconds = 0;
+
+    if (!validateInput(title)) {
+        cout << "'" << title << "' is not a valid filename.\n\n";
+        return;
+    } else if (!noteExists(title)) {
+        cout << "ERROR: '" << title << "' does not exist.\n";
+        suggestTitles(title);
+        cout << "\n";
+        return;
+    }
+
+    if (duration.empty()) {
+        if (const auto due = expiryWheel.deadline(title)) {
+            const uint64_t now = epochSeconds();
+            cout << title << " expires in " << (*due > now ? *due - now : 0)
+                 << " seconds.\n\n";
+        } else {
+            cout << title << " does not expire.\n\n";
+        }
+    } else if (duration == "off") {
+        clearExpiry(title);
+        cout << title << " will no longer expire.\n\n";
+    } else if (parseDuration(duration, seconds)) {
+        setExpiry(title, seconds);
+        logger.log(LogLevel::Info, "ttl_set", {{"note", title}, {"seconds", to_string(seconds)}});
+        cout << title << " will expire in " << duration << ".\n\n";
+    } else {
+        cout << "ERROR: '" << duration << "' is not a duration like 90s, 30m, "
+                "12h, 7d or 2w, of at most 100 years.\n\n";
+    }
+}
+
+/// Deletes the note with the given name.
+///
+/// Args:
+/// - 'title': The name of the note that the user wants to delete.
+void deleteNote(const string& title) {
+    error_code error;
+
+    if (removeNoteFiles(title, error)) {
+        clearExpiry(title);
+        unindexNotes({title});
+        logger.log(LogLevel::Info, "note_deleted", {{"note", title}});
+        cout << title << " successfully deleted!\n\n";
+    } else {
+        logger.log(LogLevel::Warn, "delete_failed", {
+            {"note", title},
+            {"error", error ? error.message() : "no such note"}});
+        cout << "ERROR: " << title << " not found or failed to delete.\n";
+        suggestTitles(title);
+        cout << "\n";
+    }
+}
+
+/// Appends <text> to note <title>, whether plain, packed or log, and
+/// updates its outline and the indexes.
+///
+/// Returns false if the note couldn't be written.
+bool appendToNote(const string& title, const string& text) {
+    LogNote log;
+    PackedNote packed;
+    bool saved = false;
+
+    if (LogNote::exists(title)) {
+        saved = log.load(title) && log.append(text);
+    } else if (PackedNote::exists(title)) {
+        saved = packed.load(title) && packed.append(text);
+        if (saved) syncFile(PackedNote::pathOf(title));
+    } else {
+        const fs::path filePath = saveDir / (title + noteExt);
+        error_code error;
+        const uintmax_t size = fs::file_size(filePath, error);
+        ofstream outfile(filePath, ios::app | ios::binary);
+        outfile << text;
+        outfile.close();
+
+        saved = !error && static_cast<bool>(outfile);
+        if (saved) {
+            syncFile(filePath);
+            extendOutline(title, size, text);
+        }
+    }
+
+    if (saved) {
+        metrics.bytesWritten.fetch_add(text.size(), memory_order_relaxed);
+        indexAppend(title, text);
+    }
+    return saved;
+}
+
+#if !defined(_WIN32) && !defined(_WIN64)
+
+/// One chunk file of an attachment, as listed in its manifest.
+///
+/// Attributes:
+/// - 'size': The number of bytes in the chunk.
+/// - 'checksum': The FNV-1a hash of the chunk's bytes.
+struct AttachmentChunk {
+    uint64_t size = 0;
+    uint64_t checksum = 0;
+};
+
+/// Hashes the first <size> bytes of the file open at <fd> through a
+/// read-only mapping, so the bytes are hashed straight out of the page
+/// cache rather than copied into a buffer first.
+///
+/// Returns false if the file couldn't be mapped.
+///
+/// Args:
+/// - 'fd': The chunk file, at most 'attachmentChunkSize' bytes long.
+/// - 'size': The number of bytes being hashed.
+/// - 'checksum': Set to the hash of the bytes.
+bool checksumChunk(int fd, uint64_t size, uint64_t& checksum) {
+    checksum = hashText("");
+    if (size == 0) return true;
+
+    void* view = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (view == MAP_FAILED) return false;
+
+    madvise(view, size, MADV_SEQUENTIAL);
+    checksum = hashText(string_view(static_cast<const char*>(view), size));
+    munmap(view, size);
+    return true;
+}
+
+/// Reads the manifest of the attachment in directory <dir>: its size, then
+/// the size and checksum of each chunk file, named by its number.
+///
+/// Returns false if the manifest is missing or doesn't add up.
+bool readAttachmentManifest(const fs::path& dir, uint64_t& size,
+                            vector<AttachmentChunk>& chunks) {
+    ifstream infile(dir / "manifest");
+    size_t count = 0;
+    if (!(infile >> size >> count)) return false;
+
+    uint64_t total = 0;
+    chunks.assign(count, AttachmentChunk());
+    for (auto& chunk : chunks) {
+        if (!(infile >> chunk.size >> hex >> chunk.checksum >> dec)) return false;
+        total += chunk.size;
+    }
+    return total == size;
+}
+
+/// Attaches a file to a note. The file is cut into chunk files of
+/// 'attachmentChunkSize' bytes that are copied inside the kernel, each
+/// checksummed from a mapping of the copy, so memory use stays the same
+/// however big the file is. The chunks are staged in a hidden directory
+/// that is only renamed into place once they and the manifest are on disk,
+/// and the note itself only gains a line naming the attachment.
+///
+/// Args:
+/// - 'arg': The note's name, then the path of the file being attached.
+void attachFile(const string& arg) {
+    const size_t space = arg.find(' ');
+    const string title = arg.substr(0, space);
+    const string source = space == string::npos ? "" : arg.substr(space + 1);
+    const string name = fs::path(source).filename().string();
+
+    if (!validateInput(title)) {
+        cout << "'" << title << "' is not a valid filename.\n\n";
+        return;
+    } else if (!noteExists(title)) {
+        cout << "ERROR: '" << title << "' does not exist.\n";
+        suggestTitles(title);
+        cout << "\n";
+        return;
+    } else if (name.empty() || name[0] == '.' || !validateInput(name) ||
+               name.find_first_of(" \t") != string::npos) {
+        cout << "ERROR: '" << name << "' can't be used as an attachment "
+                "name.\n\n";
+        return;
+    } else if (fs::exists(attachmentsOf(title) / name)) {
+        cout << "ERROR: '" << title << "' already has an attachment called '"
+             << name << "'.\n\n";
+        return;
+    }
+
+    const int inFd = open(source.c_str(), O_RDONLY);
+    struct stat info;
+    if (inFd < 0 || fstat(inFd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        if (inFd >= 0) close(inFd);
+        cout << "ERROR: '" << source << "' is not a readable file.\n\n";
+        return;
+    }
+
+    const uint64_t size = info.st_size;
+    const fs::path staging = attachmentsOf(title) / ("." + name + ".part");
+    error_code error;
+    fs::remove_all(staging, error);
+    fs::create_directories(staging, error);
+
+    vector<AttachmentChunk> chunks;
+    vector<fs::path> written;
+    bool copied = !error;
+
+    for (uint64_t offset = 0; copied && offset < size; offset += attachmentChunkSize) {
+        AttachmentChunk chunk;
+        chunk.size = min(size - offset, attachmentChunkSize);
+        written.push_back(staging / to_string(chunks.size()));
+
+        const int outFd = open(written.back().c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        copied = outFd >= 0 && copyBytes(inFd, outFd, chunk.size) &&
+                 checksumChunk(outFd, chunk.size, chunk.checksum);
+        if (outFd >= 0) close(outFd);
+        chunks.push_back(chunk);
+    }
+    close(inFd);
+
+    if (copied) {
+        ofstream manifest(staging / "manifest");
+        manifest << size << " " << chunks.size() << "\n";
+        for (const auto& chunk : chunks) {
+            manifest << chunk.size << " " << hex << chunk.checksum << dec << "\n";
+        }
+        manifest.close();
+        written.push_back(staging / "manifest");
+
+        syncStore(written);
+        if (manifest) fs::rename(staging, attachmentsOf(title) / name, error);
+        copied = manifest && !error;
+    }
+
+    if (!copied) {
+        const string reason = error ? error.message() : strerror(errno);
+        fs::remove_all(staging, error);
+        logger.log(LogLevel::Error, "attach_failed", {
+            {"note", title}, {"source", source}, {"error", reason}});
+        cout << "ERROR: '" << source << "' failed to attach to " << title
+             << ".\n\n";
+        return;
+    }
+
+    metrics.bytesRead.fetch_add(size, memory_order_relaxed);
+    metrics.bytesWritten.fetch_add(size, memory_order_relaxed);
+    logger.log(LogLevel::Info, "attachment_added", {
+        {"note", title}, {"name", name}, {"bytes", to_string(size)},
+        {"chunks", to_string(chunks.size())}});
+
+    const string reference = "[attachment: " + name + ", " + to_string(size) +
+                             " bytes]\n";
+    if (!appendToNote(title, reference)) {
+        cout << "ERROR: " << name << " was attached but " << title
+             << " failed to save a reference to it.\n\n";
+        return;
+    }
+    cout << name << " (" << size << " bytes in " << chunks.size()
+         << " chunks) attached to " << title << ".\n\n";
+}
+
+/// Lists the files attached to note <title> with their sizes.
+///
+/// Args:
+/// - 'title': The name of the note.
+void listAttachments(const string& title) {
+    if (!noteExists(title)) {
+        cout << "ERROR: '" << title << "' does not exist.\n";
+        suggestTitles(title);
+        cout << "\n";
+        return;
+    }
+
+    error_code error;
+    vector<string> names;
+    for (const auto& entry : fs::directory_iterator(attachmentsOf(title), error)) {
+        const string name = entry.path().filename().string();
+        if (entry.is_directory() && name[0] != '.') names.push_back(name);
+    }
+    sort(names.begin(), names.end());
+
+    if (names.empty()) {
+        cout << title << " has no attachments.\n\n";
+        return;
+    }
+
+    for (const auto& name : names) {
+        uint64_t size = 0;
+        vector<AttachmentChunk> chunks;
+        cout << "- " << name;
+        if (readAttachmentManifest(attachmentsOf(title) / name, size, chunks)) {
+            cout << " (" << size << " bytes)\n";
+        } else {
+            cout << " (damaged)\n";
+        }
+    }
+    cout << "\n";
+}
+
+/// Writes an attachment of a note back out to a file. Each chunk is
+/// checked against its checksum before it is copied inside the kernel, so
+/// a damaged attachment stops at the first bad chunk.
+///
+/// Args:
+/// - 'arg': The note's name, the attachment's name, then the path of the
+///   file being written.
+void extractAttachment(const string& arg) {
+    istringstream words(arg);
+    string title, name, dest;
+    words >> title >> name >> ws;
+    getline(words, dest);
+
+    const fs::path dir = attachmentsOf(title) / name;
+    uint64_t size = 0;
+    vector<AttachmentChunk> chunks;
+
+    if (!validateInput(title) || !validateInput(name) || name[0] == '.' ||
+        !fs::is_directory(dir)) {
+        cout << "ERROR: '" << title << "' has no attachment called '" << name
+             << "'.\n\n";
+        return;
+    } else if (!readAttachmentManifest(dir, size, chunks)) {
+        logger.log(LogLevel::Error, "attachment_damaged", {
+            {"note", title}, {"name", name}, {"error", "bad manifest"}});
+        cout << "ERROR: The manifest of '" << name << "' is damaged.\n\n";
+        return;
+    }
+
+    const int outFd = open(dest.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (outFd < 0) {
+        cout << "ERROR: '" << dest << "' could not be written.\n\n";
+        return;
+    }
+
+    string failure;
+    for (size_t i = 0; i < chunks.size() && failure.empty(); ++i) {
+        const int inFd = open((dir / to_string(i)).c_str(), O_RDONLY);
+        struct stat info;
+        uint64_t checksum = 0;
+
+        if (inFd < 0 || fstat(inFd, &info) != 0 ||
+            static_cast<uint64_t>(info.st_size) != chunks[i].size ||
+            !checksumChunk(inFd, chunks[i].size, checksum) ||
+            checksum != chunks[i].checksum) {
+            failure = "chunk " + to_string(i) + " is damaged";
+        } else if (!copyBytes(inFd, outFd, chunks[i].size)) {
+            failure = strerror(errno);
+        }
+        if (inFd >= 0) close(inFd);
+    }
+    close(outFd);
+
+    if (!failure.empty()) {
+        // Don't leave a file that looks whole but isn't.
+        error_code error;
+        fs::remove(dest, error);
+        logger.log(LogLevel::Error, "extract_failed", {
+            {"note", title}, {"name", name}, {"error", failure}});
+        cout << "ERROR: '" << name << "' could not be extracted: " << failure
+             << ".\n\n";
+        return;
+    }
+
+    metrics.bytesRead.fetch_add(size, memory_order_relaxed);
+    logger.log(LogLevel::Info, "attachment_extracted", {
+        {"note", title}, {"name", name}, {"bytes", to_string(size)}});
+    cout << name << " (" << size << " bytes) written to " << dest << ".\n\n";
+}
+
+#endif
+
+/// Runs 'attach', 'attachments' or 'extract'. Attachments are only
+/// supported where the chunks can be copied and mapped with POSIX calls.
+///
+/// Args:
+/// - 'command': The command being run.
+/// - 'arg': The command's argument.
+void attachmentCommand(const string& command, const string& arg) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    if (command == "attach") {
+        attachFile(arg);
+    } else if (command == "attachments") {
+        listAttachments(arg);
+    } else {
+        extractAttachment(arg);
+    }
+#else
+    (void)command;
+    (void)arg;
+    cout << "ERROR: Attachments are not supported on this system.\n\n";
+#endif
+}
+
+/// Runs 'export-tar' or 'import-tar' on the archive at <path>.
+///
+/// Args:
+/// - 'command': Either "export-tar" or "import-tar".
+/// - 'path': The archive being written or read.
+void archiveCommand(const string& command, const string& path) {
+#if !defined(_WIN32) && !defined(_WIN64)
+    const bool exporting = command == "export-tar";
+    const int fd = exporting ? open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)
+                             : open(path.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        logger.log(LogLevel::Error, "archive_open_failed", {
+            {"command", command}, {"path", path}, {"error", strerror(errno)}});
+        cout << "ERROR: Could not open '" << path << "'.\n\n";
+        return;
+    }
+
+    const long long count = exporting ? exportTar(fd) : importTar(fd);
+    close(fd);
+
+    if (count < 0) {
+        logger.log(LogLevel::Error, "archive_incomplete", {
+            {"command", command}, {"path", path}});
+        cout << "ERROR: '" << path << "' could not be "
+             << (exporting ? "written" : "read") << " completely.\n\n";
+    } else {
+        cout << count << " notes " << (exporting ? "exported to" : "imported from")
+             << " '" << path << "'.\n\n";
+    }
+#else
+    (void)path;
+    cout << "ERROR: '" << command << "' is not supported on this platform.\n\n";
+#endif
+}
+
+/// Copies the gauges owned by the main thread into 'metrics'.
+void publishGauges() {
+    for (size_t i = 0; i < subsystemCount; ++i) {
+        metrics.memory[i].store(governor.used(static_cast<Subsystem>(i)),
+                                memory_order_relaxed);
+    }
+
+    metrics.cacheHits.store(resultCache.hitCount(), memory_order_relaxed);
+    metrics.cacheMisses.store(resultCache.missCount(), memory_order_relaxed);
+    metrics.catalogNotes.store(catalog.count(), memory_order_relaxed);
+}
+
+/// Rewrites the metrics file on a background thread, for a node exporter's
+/// textfile collector to pick up.
+///
+/// Attributes:
+/// - 'worker': The thread writing the file.
+/// - 'stopping': Set by stop(), guarded by 'lock'.
+class MetricsWriter {
+    private:
+        thread worker;
+        mutex lock;
+        condition_variable wake;
+        bool stopping = false;
+
+    public:
+        /// Writes the metrics to <path> every <interval> until stopped.
+        void start(const fs::path& path, chrono::seconds interval) {
+            worker = thread([this, path, interval] {
+                unique_lock<mutex> guard(lock);
+                while (!wake.wait_for(guard, interval, [this] { return stopping; })) {
+                    if (!metrics.writeFile(path)) {
+                        logger.log(LogLevel::Warn, "metrics_write_failed",
+                                   {{"path", path.string()}});
+                    }
+                }
+                metrics.writeFile(path);
+            });
+        }
+
+        /// Stops the thread after one last write.
+        void stop() {
+            {
+                lock_guard<mutex> guard(lock);
+                stopping = true;
+            }
+            wake.notify_one();
+            if (worker.joinable()) worker.join();
+        }
+};
+
+/// Limits the rate of maintenance I/O. Spending may run the bucket into
+/// debt; the caller then waits before its next step instead of sleeping in
+/// the middle of one.
+///
+/// Attributes:
+/// - 'rate': Bytes added per second, also the most the bucket holds.
+/// - 'tokens': Bytes that can be spent now; negative when in debt.
+class TokenBucket {
+    private:
+        double rate;
+        double tokens;
+        chrono::steady_clock::time_point refilled = chrono::steady_clock::now();
+
+        void refill() {
+            const auto now = chrono::steady_clock::now();
+            tokens = min(rate, tokens + rate * chrono::duration<double>(
+                                                  now - refilled).count());
+            refilled = now;
+        }
+
+    public:
+        explicit TokenBucket(double bytesPerSecond)
+            : rate(bytesPerSecond), tokens(bytesPerSecond) {}
+
+        void setRate(double bytesPerSecond) { rate = tokens = bytesPerSecond; }
+        void spend(uint64_t bytes) { refill(); tokens -= bytes; }
+
+        /// Returns how long to wait until the bucket is out of debt.
+        chrono::milliseconds debtWait() {
+            refill();
+            if (tokens >= 0) return chrono::milliseconds(0);
+            return chrono::milliseconds(static_cast<long long>(-tokens / rate * 1000) + 1);
+        }
+};
+
+/// Runs maintenance jobs on a background thread while the prompt is idle.
+///
+/// The prompt holds 'storeMutex' from reading a command until it is done
+/// with it, and a job holds it for one short step, so jobs and commands
+/// never touch the store or its indexes at the same time. Once the prompt
+/// has waited 'maintenanceIdleSeconds' for input, the worker runs one step
+/// of the highest-priority job that has work, then starts again from the
+/// top. A command arriving preempts the worker between steps, so it waits
+/// for one step at most. The worker runs at the lowest CPU and I/O priority
+/// and its I/O is paced by a token bucket.
+///
+/// Each job's step does a bounded amount of work, at most one log segment
+/// or 'streamChunkSize' bytes, passes the bytes it is about to read or
+/// write to 'charge' before doing so, and returns false once it has
+/// nothing left to do this round. A round ends whenever a command runs.
+class Maintenance {
+    public:
+        using Charge = function<void(uint64_t bytes)>;
+        using Step = function<bool(size_t round, const Charge& charge)>;
+
+    private:
+        struct Job {
+            string name;
+            int priority;
+            Step step;
+        };
+
+        struct Timer {
+            string name;
+            chrono::seconds interval;
+            function<void()> task;
+            chrono::steady_clock::time_point next;
+        };
+
+        vector<Job> jobs;
+        vector<Timer> timers;
+        mutex storeMutex;
+        atomic<bool> userActive{true};
+        atomic<size_t> round{0};
+        atomic<bool> stopping{false};
+        chrono::steady_clock::time_point idleSince;
+        mutex idleLock;
+        TokenBucket bucket{defaultMaintenanceRate};
+        thread worker;
+
+        /// Moves the calling thread to the lowest CPU and I/O priority.
+        static void lowerPriority() {
+#if defined(__linux__)
+            const pid_t tid = static_cast<pid_t>(syscall(SYS_gettid));
+            setpriority(PRIO_PROCESS, tid, 19);
+            // IOPRIO_WHO_PROCESS, IOPRIO_CLASS_IDLE.
+            syscall(SYS_ioprio_set, 1, tid, 3 << 13);
+#endif
+        }
+
+        bool idleLongEnough() {
+            lock_guard<mutex> guard(idleLock);
+            return chrono::steady_clock::now() - idleSince >=
+                   chrono::seconds(maintenanceIdleSeconds);
+        }
+
+        /// Sleeps for <duration>, waking early if a command arrives.
+        void pause(chrono::milliseconds duration) {
+            const auto until = chrono::steady_clock::now() + duration;
+            while (!userActive && !stopping && chrono::steady_clock::now() < until) {
+                this_thread::sleep_for(chrono::milliseconds(10));
+            }
+        }
+
+        /// Runs each timer task that is due, unless a command is running.
+        void runTimers() {
+            const auto now = chrono::steady_clock::now();
+
+            for (auto& timer : timers) {
+                if (now < timer.next || userActive) continue;
+                unique_lock<mutex> store(storeMutex, try_to_lock);
+                if (!store.owns_lock()) return;
+
+                governor.hold();
+                timer.task();
+                governor.release();
+                timer.next = now + timer.interval;
+            }
+        }
+
+        void run() {
+            lowerPriority();
+            size_t finishedRound = SIZE_MAX;
+
+            while (!stopping) {
+                runTimers();
+                const size_t current = round.load();
+                if (userActive || current == finishedRound || !idleLongEnough()) {
+                    this_thread::sleep_for(chrono::milliseconds(100));
+                    continue;
+                }
+
+                pause(bucket.debtWait());
+                if (userActive || stopping) continue;
+
+                bool worked = false;
+                for (const auto& job : jobs) {
+                    unique_lock<mutex> store(storeMutex, try_to_lock);
+                    if (!store.owns_lock() || userActive) break;
+
+                    uint64_t bytes = 0;
+                    const auto charge = [&](uint64_t planned) {
+                        bucket.spend(planned);
+                        bytes += planned;
+                    };
+                    const auto start = chrono::steady_clock::now();
+                    governor.hold();
+                    worked = job.step(current, charge);
+                    governor.release();
+                    store.unlock();
+
+                    if (worked) {
+                        logger.log(LogLevel::Debug, "maintenance_step", {
+                            {"job", job.name}, {"bytes", to_string(bytes)},
+                            {"seconds", to_string(secondsSince(start))}});
+                        break;
+                    }
+                }
+
+                if (!worked && !userActive) finishedRound = current;
+            }
+        }
+
+    public:
+        /// Adds a job; jobs with a higher <priority> run first.
+        void add(const string& name, int priority, Step step) {
+            jobs.push_back({name, priority, move(step)});
+            stable_sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) {
+                return a.priority > b.priority;
+            });
+        }
+
+        /// Adds a task run every <interval> whenever no command is running,
+        /// idle or not, and whether or not the jobs have work.
+        void every(const string& name, chrono::seconds interval, function<void()> task) {
+            timers.push_back({name, interval, move(task), chrono::steady_clock::now()});
+        }
+
+        /// Starts the worker with an I/O budget of <bytesPerSecond>.
+        void start(double bytesPerSecond) {
+            bucket.setRate(bytesPerSecond);
+            worker = thread([this] { run(); });
+        }
+
+        void stop() {
+            stopping = true;
+            if (worker.joinable()) worker.join();
+        }
+
+        /// Called when a command arrives. Returns the lock to hold while it
+        /// runs.
+        unique_lock<mutex> beginCommand() {
+            userActive = true;
+            return unique_lock<mutex>(storeMutex);
+        }
+
+        /// Called once the prompt waits for input again.
+        void endCommand() {
+            {
+                lock_guard<mutex> guard(idleLock);
+                idleSince = chrono::steady_clock::now();
+            }
+            round++;
+            userActive = false;
+        }
+};
+
+Maintenance maintenance; // Idle-time upkeep of the store; see Maintenance.
+
+/// Walks the save directory a few entries per call, restarting each round.
+///
+/// Attributes:
+/// - 'it': Where the walk is.
+/// - 'round': The round the walk belongs to.
+class DirectoryWalk {
+    private:
+        fs::directory_iterator it;
+        size_t round = SIZE_MAX;
+
+    public:
+        /// Sets <entry> to the next entry of this round's walk. Returns
+        /// false once the walk is done.
+        bool next(size_t currentRound, fs::directory_entry& entry) {
+            error_code error;
+            if (round != currentRound) {
+                round = currentRound;
+                it = fs::directory_iterator(saveDir, error);
+                if (error) it = fs::directory_iterator();
+            }
+
+            if (it == fs::directory_iterator()) return false;
+            entry = *it;
+            it.increment(error);
+            if (error) it = fs::directory_iterator();
+            return true;
+        }
+};
+
+/// Registers the maintenance jobs, most urgent first:
+/// - 'catalog-merge' folds pending catalog changes into its arrays.
+/// - 'log-compaction' compresses the sealed segments of log notes.
+/// - 'outline-refresh' rebuilds outlines that went stale.
+/// - 'segment-scrub' checks sealed log segments can be read back, once per
+///   session, and logs any that can't.
+///
+/// Each step handles one segment or one chunk of a note and remembers
+/// where it stopped, so a big note is worked through over many steps.
+/// Notes whose TTL is up are also deleted every second.
+void registerMaintenanceJobs() {
+    const size_t entriesPerStep = 256;
+
+    maintenance.every("note-expiry", chrono::seconds(1), expireNotes);
+
+    maintenance.add("catalog-merge", 40, [](size_t, const Maintenance::Charge&) {
+        if (!catalog.hasPending()) return false;
+        catalog.merge();
+        governor.set(Subsystem::Catalog, catalog.memoryUsage());
+        return true;
+    });
+
+    // Compresses one segment per step, picking up where the last step
+    // left off.
+    auto compactWalk = make_shared<DirectoryWalk>();
+    auto compactLog = make_shared<pair<string, size_t>>();
+    maintenance.add("log-compaction", 30, [=](size_t round, const Maintenance::Charge& charge) {
+        LogNote log;
+        fs::directory_entry entry;
+
+        for (size_t seen = 0; seen < entriesPerStep; ++seen) {
+            if (!compactLog->first.empty() && log.load(compactLog->first)) {
+                while (compactLog->second < log.sealedCount() &&
+                       log.segment(compactLog->second).compressed) {
+                    compactLog->second++;
+                }
+
+                if (compactLog->second < log.sealedCount()) {
+                    uint64_t saved = 0;
+                    charge(log.segment(compactLog->second).rawSize);
+                    log.compressSegment(compactLog->second++, saved);
+                    return true;
+                }
+            }
+
+            compactLog->first.clear();
+            if (!compactWalk->next(round, entry)) return false;
+            if (entry.path().extension() == logExt) {
+                *compactLog = {entry.path().stem().string(), 0};
+            }
+        }
+
+        return true;
+    });
+
+    // Rebuilds one stale outline a chunk per step. 'scanned' doubles as the
+    // cursor; the build starts over if the note is written in between.
+    auto outlineWalk = make_shared<DirectoryWalk>();
+    auto outlineBuild = make_shared<pair<string, Outline>>();
+    maintenance.add("outline-refresh", 20, [=](size_t round, const Maintenance::Charge& charge) {
+        auto& [title, outline] = *outlineBuild;
+        fs::directory_entry entry;
+
+        for (size_t seen = 0; title.empty() && seen < entriesPerStep; ++seen) {
+            if (!outlineWalk->next(round, entry)) return false;
+            if (entry.path().extension() != noteExt) continue;
+
+            Outline saved;
+            if (saved.load(entry.path().stem().string()) && saved.matches(entry.path())) continue;
+
+            title = entry.path().stem().string();
+            outline = Outline();
+            outline.stamp(entry.path());
+            outline.scanned = 0;
+        }
+        if (title.empty()) return true;
+
+        const fs::path filePath = saveDir / (title + noteExt);
+        error_code error;
+        const uint64_t size = fs::file_size(filePath, error);
+        const long long modified = fs::last_write_time(filePath, error)
+                                       .time_since_epoch().count();
+        if (error || modified != outline.modified || size < outline.scanned) {
+            title.clear();
+            return true;
+        }
+
+        const uint64_t offset = outline.scanned;
+        string text(min<uint64_t>(size - offset, streamChunkSize), '\0');
+        charge(text.size());
+        ifstream infile(filePath, ios::binary);
+        infile.seekg(offset);
+        infile.read(&text[0], text.size());
+        text.resize(infile.gcount());
+
+        // Scan whole lines only, unless one line fills the chunk.
+        const size_t lineEnd = text.rfind('\n');
+        if (offset + text.size() < size && lineEnd != string::npos) {
+            text.resize(lineEnd + 1);
+        }
+        istringstream in(text);
+        outline.scan(in, offset);
+        outline.scanned = offset + text.size();
+
+        if (text.empty() || outline.scanned >= size) {
+            outline.stamp(filePath);
+            outline.save(title);
+            title.clear();
+        }
+        return true;
+    });
+
+    // Verifies one segment per step, each log note once per session.
+    auto scrubWalk = make_shared<DirectoryWalk>();
+    auto scrubbed = make_shared<set<string>>();
+    auto scrubLog = make_shared<pair<string, size_t>>();
+    maintenance.add("segment-scrub", 10, [=](size_t round, const Maintenance::Charge& charge) {
+        LogNote log;
+        fs::directory_entry entry;
+
+        for (size_t seen = 0; seen < entriesPerStep; ++seen) {
+            const string& title = scrubLog->first;
+            if (!title.empty() && log.load(title) && scrubLog->second < log.sealedCount()) {
+                const size_t i = scrubLog->second++;
+                charge(log.segment(i).storedSize);
+                if (!log.verifySegment(i)) {
+                    logger.log(LogLevel::Error, "segment_corrupt", {
+                        {"note", title}, {"segment", to_string(log.segment(i).number)}});
+                }
+                return true;
+            }
+
+            scrubLog->first.clear();
+            if (!scrubWalk->next(round, entry)) return false;
+            const string next = entry.path().stem().string();
+            if (entry.path().extension() != logExt || scrubbed->count(next)) continue;
+
+            scrubbed->insert(next);
+            *scrubLog = {next, 0};
+        }
+
+        return true;
+    });
+}
+
+/// Handler function for the user commands and prompts.
+void promptHandler() {
+    string cmd;
+
+    // User loop.
+    while (true) {
+        cout << "$~ ";
+        maintenance.endCommand();
+        getline(cin, cmd);
+        const auto store = maintenance.beginCommand();
+        governor.hold();
+        syncSharedCatalog();
+        expireNotes();
+        const string arg = extractArg(cmd);
+        const auto start = chrono::steady_clock::now();
+
+        if (cmd == "exit") {
+            break;
+
+        } else if (cmd == "help") {
+            cout << "- 'new [note]' to create a new note.\n"
+                    "- 'new [note] [ttl]' to create a note that is deleted "
+                    "after a time such as 30m, 12h or 7d.\n"
+                    "- 'ttl [note] [ttl|off]' to show or change when a note "
+                    "is deleted.\n"
+                    "- 'app [note]' to append an existing note.\n"
+                    "- 'ow [note]' to overwrite an existing note.\n"
+                    "- 'del [note]' to delete an existing note.\n"
+                    "- 'newlog [note]' to create a log note, kept as "
+                    "segments of about 1 MB.\n"
+                    "- 'tail [note]' to show the end of a note.\n"
+                    "- 'outline [note]' to list the headings of a note.\n"
+                    "- 'open [note]' or 'open [note]#[section]' to show a "
+                    "note or one section of it, by number or heading.\n"
+                    "- 'compress [note]' to compress a note, or the full "
+                    "segments of a log note.\n"
+                    "- 'view [note] [from]-[to]' to show some lines of a "
+                    "note.\n"
+                    "- 'sort [note]' / 'uniq [note]' to sort the lines of a "
+                    "note, or sort them and drop repeats.\n"
+                    "- 'timeline [from] [to] [note ...]' to merge the "
+                    "timestamped lines of notes, e.g. 'timeline "
+                    "2026-10-18T14:00 2026-10-18T15:00'.\n"
+                    "- 'attach [note] [file]' to attach a file of any size "
+                    "to a note.\n"
+                    "- 'attachments [note]' to list the files attached to a "
+                    "note.\n"
+                    "- 'extract [note] [name] [file]' to write an attached "
+                    "file back out.\n"
+                    "- 'ls' to list all saved files.\n"
+                    "- 'ls --tag [a] --any [b] --not [c]' to list notes by "
+                    "#tag.\n"
+                    "- 'query [conditions]' to search notes, e.g. 'query "
+                    "tag:ops since:2026-09 \"disk full\" title:inc-*'.\n"
+                    "- 'related [note]' to list the notes most like a "
+                    "note.\n"
+                    "- 'replace [--preview] [pattern] [replacement]' to "
+                    "replace text in every note at once.\n"
+                    "- 'mount [name] [dir]' to include another note store "
+                    "in 'ls' and 'query', read-only.\n"
+                    "- 'unmount [name]' / 'mounts' to remove or list mounted "
+                    "stores.\n"
+                    "- 'export-html [dir]' to export every note as a web "
+                    "page.\n"
+                    "- 'export-tar [file]' / 'import-tar [file]' to move "
+                    "every note to or from a tar archive.\n"
+                    "- 'stats' to show memory use.\n"
+                    "- 'cls' to clear the screen.\n"
+                    "- 'exit' to exit the program.\n\n";
+        
+        } else if (cmd == "cls") {
+            system(clearScreen);
+
+        } else if (cmd == "ls") {
+            listNotes();
+
+        } else if (cmd.compare(0, 3, "ls ") == 0) {
+            listTaggedNotes(arg);
+
+        } else if (cmd.compare(0, 6, "query ") == 0) {
+            runQuery(arg);
+
+        } else if (cmd.compare(0, 12, "export-html ") == 0) {
+            exportHtml(arg);
+
+        } else if (cmd.compare(0, 11, "export-tar ") == 0 ||
+                   cmd.compare(0, 11, "import-tar ") == 0) {
+            archiveCommand(cmd.substr(0, 10), arg);
+
+        } else if (cmd.compare(0, 5, "open ") == 0) {
+            openSection(arg);
+
+        } else if (cmd.compare(0, 4, "ttl ") == 0 && countWords(cmd) <= 3) {
+            noteTtl(arg);
+
+        } else if (cmd.compare(0, 9, "timeline ") == 0) {
+            printTimeline(arg);
+
+        } else if (cmd.compare(0, 7, "attach ") == 0 ||
+                   cmd.compare(0, 8, "extract ") == 0) {
+            attachmentCommand(cmd.substr(0, cmd.find(' ')), arg);
+
+        } else if (cmd.compare(0, 8, "replace ") == 0) {
+            replaceText(arg);
+
+        } else if (cmd.compare(0, 5, "view ") == 0 && countWords(cmd) == 3) {
+            viewLines(arg);
+
+        } else if (cmd.compare(0, 6, "mount ") == 0) {
+            mountStore(arg);
+
+        } else if (cmd == "mounts") {
+            listMounts();
+
+        } else if (cmd == "stats") {
+            ensureCatalog();
+            cout << "Memory use:\n";
+            governor.report(cout);
+            reportCatalog();
+            cout << "Query cache: " << resultCache.size() << " results, "
+                 << resultCache.hitCount() << " hits, "
+                 << resultCache.missCount() << " misses.\n";
+            cout << "\n";
+        
+        // Any conditions after these require valid input for filenames.
+        } else if (countWords(cmd) == 2 && !validateInput(arg)) {
+            cout << "'" << arg << "' is not a valid filename.\n\n";
+        
+        } else if (cmd.compare(0, 4, "del ") == 0 && countWords(cmd) == 2) {
+            deleteNote(arg);
+
+        } else if (cmd.compare(0, 4, "new ") == 0 && countWords(cmd) == 2) {
+            createNote(arg);
+
+        } else if (cmd.compare(0, 4, "new ") == 0 && countWords(cmd) == 3) {
+            const string title = arg.substr(0, arg.find(' '));
+            const string duration = arg.substr(arg.find(' ') + 1);
+            uint64_t seconds = 0;
+
+            if (!validateInput(title)) {
+                cout << "'" << title << "' is not a valid filename.\n\n";
+            } else if (!parseDuration(duration, seconds)) {
+                cout << "ERROR: '" << duration << "' is not a duration like 90s, "
+                        "30m, 12h, 7d or 2w, of at most 100 years.\n\n";
+            } else if (noteExists(title)) {
+                cout << "ERROR: '" << title << "' already exists.\n\n";
+            } else {
+                createNote(title);
+                if (noteExists(title)) setExpiry(title, seconds);
+            }
+
+        } else if (cmd.compare(0, 4, "app ") == 0 && countWords(cmd) == 2) {
+            loadNote(arg, true);
+        
+        } else if (cmd.compare(0, 3, "ow ") == 0 && countWords(cmd) == 2) {
+            loadNote(arg, false);
+
+        } else if (cmd.compare(0, 7, "newlog ") == 0 && countWords(cmd) == 2) {
+            createLogNote(arg);
+
+        } else if (cmd.compare(0, 5, "tail ") == 0 && countWords(cmd) == 2) {
+            tailNote(arg);
+
+        } else if (cmd.compare(0, 9, "compress ") == 0 && countWords(cmd) == 2) {
+            compressNote(arg);
+
+        } else if (cmd.compare(0, 8, "outline ") == 0 && countWords(cmd) == 2) {
+            printOutline(arg);
+
+        } else if (cmd.compare(0, 5, "sort ") == 0 && countWords(cmd) == 2) {
+            sortNote(arg, false);
+
+        } else if (cmd.compare(0, 5, "uniq ") == 0 && countWords(cmd) == 2) {
+            sortNote(arg, true);
+
+        } else if (cmd.compare(0, 8, "related ") == 0 && countWords(cmd) == 2) {
+            relatedNotes(arg);
+
+        } else if (cmd.compare(0, 12, "attachments ") == 0 && countWords(cmd) == 2) {
+            attachmentCommand("attachments", arg);
+
+        } else if (cmd.compare(0, 8, "unmount ") == 0 && countWords(cmd) == 2) {
+            unmountStore(arg);
+
+        } else if (cmd.compare(0, 3, "del") == 0 ||
+                   cmd.compare(0, 3, "new") == 0 ||
+                   cmd.compare(0, 3, "app") == 0 ||
+                   cmd.compare(0, 2, "ow") == 0 ||
+                   cmd == "tail" || cmd == "compress" ||
+                   cmd == "outline" || cmd == "open" ||
+                   cmd == "unmount" || cmd == "related" || cmd == "timeline" || cmd == "ttl" ||
+                   cmd == "replace" || cmd == "sort" || cmd == "uniq" ||
+                   cmd == "attach" || cmd == "attachments" || cmd == "extract" ||
+                   cmd.compare(0, 4, "view") == 0) {
+            cout << "ERROR: Missing argument (filename).\n\n";
+            
+        } else {
+            cout << "'" << cmd << "' is not a valid command.\n\n";
+        }
+
+        governor.release();
+        metrics.recordCommand(cmd, secondsSince(start));
+        publishGauges();
+    }
+}
+
+/// Reads environment variable <name>, if it is set, as a number of MB
+/// above 0 into <bytes>. Anything else is reported and <bytes> keeps its
+/// default.
+void readMegabytesSetting(const char* name, size_t& bytes) {
+    const char* value = getenv(name);
+    if (!value) return;
+
+    char* end = nullptr;
+    errno = 0;
+    const unsigned long long megabytes = strtoull(value, &end, 10);
+
+    if (!isdigit(static_cast<unsigned char>(value[0])) || *end != '\0' ||
+        errno == ERANGE || megabytes == 0 || megabytes > (SIZE_MAX >> 20)) {
+        cout << "ERROR: " << name << " must be a number of MB above 0; using "
+             << (bytes >> 20) << " MB.\n\n";
+        return;
+    }
+    bytes = megabytes << 20;
+}
+
+/// CPPNotes is a barebones console notes program that allows the user to
+/// create and load notes through their terminal.
+///
+/// Run as 'cppnotes export-tar > notes.tar' or 'cppnotes import-tar <
+/// notes.tar' to stream the whole store through a pipe without the prompt.
+int main(int argc, char* argv[]) {
+    if (argc == 2) {
+#if !defined(_WIN32) && !defined(_WIN64)
+        const string command = argv[1];
+        if (!fs::exists(saveDir)) fs::create_directories(saveDir);
+
+        if (command == "export-tar" || command == "import-tar") {
+            logger.start();
+            finishReplace();
+            attachSharedCatalog();
+            const long long count = command == "export-tar"
+                ? exportTar(STDOUT_FILENO) : importTar(STDIN_FILENO);
+            logger.log(count < 0 ? LogLevel::Error : LogLevel::Info, "archive_piped",
+                       {{"command", command}, {"notes", to_string(count)}});
+            logger.stop();
+            cerr << (count < 0 ? "ERROR: The archive is damaged or was cut short."
+                               : to_string(count) + " notes.") << "\n";
+            return count < 0 ? 1 : 0;
+        }
+#endif
+        cerr << "Usage: " << argv[0] << " [export-tar | import-tar]\n";
+        return 1;
+    }
+
+    cout << "Welcome to CPPNotes!\n";
+    cout << "Enter a command (help | new | app | ow | del | ls | tail | "
+            "stats | cls | exit)\n\n";
+
+    // Make sure the save directory 'savedNotes\' always exists.
+    if (!fs::exists(saveDir)) {
+        fs::create_directories(saveDir);
+    }
+
+    // Diagnostics go to 'logPath'. CPPNOTES_LOG_LEVEL sets the lowest level
+    // logged: debug, info (the default), warn or error.
+    if (const char* level = getenv("CPPNOTES_LOG_LEVEL")) {
+        const array<string, 4> levels = {"debug", "info", "warn", "error"};
+        const auto found = find(levels.begin(), levels.end(), toLower(level));
+        if (found != levels.end()) {
+            logger.setThreshold(static_cast<LogLevel>(found - levels.begin()));
+        }
+    }
+    logger.start();
+    finishReplace();
+    attachSharedCatalog();
+    loadExpiries();
+
+    // The memory budget can be changed with CPPNOTES_MEMORY_BUDGET (in MB).
+    size_t budget = defaultMemoryBudget << 20;
+    readMegabytesSetting("CPPNOTES_MEMORY_BUDGET", budget);
+    governor.setBudget(budget);
+
+    readMegabytesSetting("CPPNOTES_LARGE_NOTE_MB", largeNoteThreshold);
+
+    readMegabytesSetting("CPPNOTES_SORT_MEMORY_MB", sortMemoryLimit);
+
+    // Metrics are written to CPPNOTES_METRICS_FILE, if set, every
+    // CPPNOTES_METRICS_INTERVAL seconds.
+    MetricsWriter metricsWriter;
+    if (const char* metricsFile = getenv("CPPNOTES_METRICS_FILE")) {
+        const char* interval = getenv("CPPNOTES_METRICS_INTERVAL");
+        const long seconds = interval ? strtol(interval, nullptr, 10) : 0;
+        metricsWriter.start(metricsFile, chrono::seconds(
+            seconds > 0 ? seconds : defaultMetricsInterval));
+    }
+
+    governor.registerEvictor(Subsystem::QueryCache, true, [] {
+        resultCache.clear();
+        return size_t{0};
+    });
+
+    governor.registerEvictor(Subsystem::Catalog, true, [] {
+        catalog.clear();
+        return size_t{0};
+    });
+
+    // The search indexes are rebuilt from the saved notes on their next use.
+    governor.registerEvictor(Subsystem::SearchIndex, true, [] {
+        vocabulary.clear();
+        tagIndex.clear();
+        wordIndex.clear();
+        similarity.clear();
+        titleTrie.clear();
+        return size_t{0};
+    });
+
+    // Mounted stores build their indexes again the next time they are searched.
+    governor.registerEvictor(Subsystem::Mounts, true, [] {
+        if (searchingMounts) {
+            return governor.used(Subsystem::Mounts);
+        }
+        for (auto& store : mounts) store->unload();
+        return size_t{0};
+    });
+    
+    // Maintenance I/O is limited to CPPNOTES_MAINTENANCE_KBPS; 0 turns it off.
+    const char* maintenanceRate = getenv("CPPNOTES_MAINTENANCE_KBPS");
+    const double rate = maintenanceRate ? strtod(maintenanceRate, nullptr) * 1024
+                                        : defaultMaintenanceRate;
+    registerMaintenanceJobs();
+    if (rate > 0) maintenance.start(rate);
 
-    // Make sure the save directory 'savedNotes\' always exists.
-    if (!fs::exists(saveDir)) {
-        fs::create_directories(saveDir);
-    }
-    
     promptHandler();
+    maintenance.stop();
+    metricsWriter.stop();
+    logger.stop();
 
     return 0;
 }